@@ -0,0 +1,47 @@
+#ifndef __DIR_ENTRIES_H__
+#define __DIR_ENTRIES_H__
+
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstddef>
+
+// Entry returned by getdents64(2)
+struct linux_dirent64 {
+  ino64_t        d_ino;
+  off64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+
+// Read the next chunk of entries of the directory dir_fd, from its
+// current offset, into buf, and call f(name, type) for each entry but
+// "." and "..". Unlike readdir(3), nothing is allocated and a chunk
+// takes one system call. Returns the number of bytes read, 0 at the end
+// of the directory, -1 on error.
+template<typename F>
+long read_entries(int dir_fd, char* buf, size_t size, F f) {
+  const long len = syscall(SYS_getdents64, dir_fd, buf, size);
+  for(long off = 0; off < len; ) {
+    const linux_dirent64* ent = (const linux_dirent64*)(buf + off);
+    off += ent->d_reclen;
+    if(ent->d_name[0] == '.' && (ent->d_name[1] == '\0' || (ent->d_name[1] == '.' && ent->d_name[2] == '\0')))
+      continue;
+    f((const char*)ent->d_name, ent->d_type);
+  }
+  return len;
+}
+
+// Call f(name, type) for all the entries of dir_fd, from its current
+// offset. Returns false on error.
+template<typename F>
+bool for_each_entry(int dir_fd, F f) {
+  alignas(linux_dirent64) char buf[64 * 1024];
+  long len;
+  while((len = read_entries(dir_fd, buf, sizeof(buf), f)) > 0) ;
+  return len == 0;
+}
+
+#endif /* __DIR_ENTRIES_H__ */
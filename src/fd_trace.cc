@@ -0,0 +1,157 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <src/fd_trace.hpp>
+
+// Offset and inode in the content of a fdinfo file. Returns false if
+// the offset is not found. The inode is 0 if not given, by older
+// kernels.
+static bool parse_pos_ino(char* buf, off_t& offset, ino_t& inode) {
+  const char* pos = strstr(buf, "pos:");
+  const char* ino = strstr(buf, "ino:");
+  if(!pos) return false;
+  offset = strtoll(pos + 4, nullptr, 10);
+  inode  = ino ? strtoull(ino + 4, nullptr, 10) : 0;
+  return true;
+}
+
+fd_trace::fd_trace(pid_t pid, int fd, unsigned rate, double stall, std::ostream& os)
+  : fdinfo_fd_(-1)
+  , timer_fd_(-1)
+  , inode_(0)
+  , stop_(false)
+  , dropped_(0)
+  , os_(os)
+  , stall_(stall)
+  , offset_(-1)
+  , closed_(false)
+  , reported_(0)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/fdinfo/%d", (int)pid, fd);
+  char  buf[256];
+  off_t offset;
+  fdinfo_fd_ = open(path, O_RDONLY | O_CLOEXEC);
+  const ssize_t len = fdinfo_fd_ == -1 ? -1 : pread(fdinfo_fd_, buf, sizeof(buf) - 1, 0);
+  if(len <= 0) {
+    error_ = std::string("Can't read ") + path + ": " + strerror(errno);
+    return;
+  }
+  buf[len] = '\0';
+  if(!parse_pos_ino(buf, offset, inode_)) {
+    error_ = std::string("No offset in ") + path;
+    return;
+  }
+
+  timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  if(timer_fd_ == -1) {
+    error_ = std::string("Can't create timer: ") + strerror(errno);
+    return;
+  }
+  const long period = 1000000000L / std::max(rate, 1u);
+  itimerspec spec;
+  spec.it_interval.tv_sec  = period / 1000000000L;
+  spec.it_interval.tv_nsec = period % 1000000000L;
+  spec.it_value            = spec.it_interval;
+  if(timerfd_settime(timer_fd_, 0, &spec, nullptr) == -1) {
+    error_ = std::string("Can't start timer: ") + strerror(errno);
+    return;
+  }
+
+  os_ << "# pvof trace of pid " << pid << " fd " << fd << ", " << rate << " samples/s\n"
+      << "# seconds offset bytes/s" << std::endl;
+  thread_ = std::thread(&fd_trace::run, this);
+}
+
+fd_trace::~fd_trace() {
+  stop_ = true;
+  if(thread_.joinable())
+    thread_.join();
+  if(error_.empty())
+    drain();
+  if(!closed_ && start_ != mono_time())
+    end_stall(last_);
+  os_ << std::flush;
+  if(timer_fd_ != -1)
+    close(timer_fd_);
+  if(fdinfo_fd_ != -1)
+    close(fdinfo_fd_);
+}
+
+void fd_trace::run() {
+  char     buf[256];
+  uint64_t expirations;
+  while(!stop_.load(std::memory_order_relaxed)) {
+    if(read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations))
+      continue; // Interrupted
+    sample        s;
+    ino_t         inode;
+    const ssize_t len = pread(fdinfo_fd_, buf, sizeof(buf) - 1, 0);
+    s.stamp = mono_now();
+    if(len > 0)
+      buf[len] = '\0';
+    if(len <= 0 || !parse_pos_ino(buf, s.offset, inode) || (inode_ && inode != inode_)) {
+      // Closed or reused. Wait for room to report it
+      s.offset = -1;
+      while(!ring_.push(s) && !stop_.load(std::memory_order_relaxed)) {
+        if(read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations))
+          continue; // Interrupted
+      }
+      break;
+    }
+    if(!ring_.push(s))
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void fd_trace::end_stall(const mono_time& now) {
+  const double duration = to_seconds(now - stall_start_);
+  if(duration >= stall_ && stall_ > 0) {
+    char line[128];
+    snprintf(line, sizeof(line), "# stall %.6f for %.6fs\n", to_seconds(stall_start_ - start_), duration);
+    os_ << line;
+  }
+}
+
+void fd_trace::drain() {
+  char   line[128];
+  sample s;
+  while(!closed_ && ring_.pop(s)) {
+    if(start_ == mono_time()) {
+      start_       = s.stamp;
+      last_        = s.stamp;
+      stall_start_ = s.stamp;
+      offset_      = s.offset;
+    }
+    if(s.offset == -1) {
+      end_stall(last_);
+      snprintf(line, sizeof(line), "# closed %.6f\n", to_seconds(s.stamp - start_));
+      os_ << line;
+      closed_ = true;
+      break;
+    }
+    const double dt    = to_seconds(s.stamp - last_);
+    const double speed = dt > 0 ? (s.offset - offset_) / dt : 0;
+    if(s.offset != offset_) {
+      end_stall(last_);
+      stall_start_ = s.stamp;
+    }
+    snprintf(line, sizeof(line), "%.6f %lld %.0f\n", to_seconds(s.stamp - start_), (long long)s.offset, speed);
+    os_ << line;
+    last_   = s.stamp;
+    offset_ = s.offset;
+  }
+  const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if(dropped != reported_) {
+    snprintf(line, sizeof(line), "# dropped %llu samples\n", (unsigned long long)(dropped - reported_));
+    os_ << line;
+    reported_ = dropped;
+  }
+  os_ << std::flush;
+}
@@ -0,0 +1,99 @@
+#ifndef __FD_TRACE_H__
+#define __FD_TRACE_H__
+
+#include <sys/types.h>
+#include <array>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <ostream>
+
+#include <src/mono_time.hpp>
+
+// Ring buffer of fixed capacity N (a power of 2) between one producer
+// and one consumer thread, without locks: the producer only writes
+// head_ and the consumer only writes tail_.
+template<typename T, size_t N>
+class spsc_ring {
+  static_assert((N & (N - 1)) == 0, "The capacity must be a power of 2");
+  std::array<T, N>                 data_;
+  alignas(64) std::atomic<size_t>  head_; // Next slot written
+  alignas(64) std::atomic<size_t>  tail_; // Next slot read
+
+public:
+  spsc_ring() : head_(0), tail_(0) { }
+
+  // False if the ring is full
+  bool push(const T& x) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if(head - tail_.load(std::memory_order_acquire) == N) return false;
+    data_[head & (N - 1)] = x;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // False if the ring is empty
+  bool pop(T& x) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if(tail == head_.load(std::memory_order_acquire)) return false;
+    x = data_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+// High rate trace of the offset of one descriptor (--trace). A thread
+// reads its fdinfo at every expiration of a timerfd, with pread(2) on a
+// descriptor kept open, and queues the timestamped offsets in a
+// lock-free ring. The main loop writes them with drain(): one line per
+// sample with the throughput since the previous sample, and one line
+// per stall, the offset unchanged for at least stall seconds.
+//
+// The trace ends when the descriptor is closed or reused for another
+// file. Reuse is seen only if fdinfo gives the inode.
+class fd_trace {
+public:
+  struct sample {
+    mono_time stamp;
+    off_t     offset; // -1 when the descriptor was closed
+  };
+
+private:
+  int                         fdinfo_fd_;
+  int                         timer_fd_;
+  ino_t                       inode_;
+  std::string                 error_;
+  spsc_ring<sample, 1 << 16>  ring_;
+  std::atomic<bool>           stop_;
+  std::atomic<uint64_t>       dropped_; // Samples lost, the ring being full
+  std::thread                 thread_;
+
+  // Written by drain(), in the main loop
+  std::ostream&               os_;
+  const double                stall_;
+  mono_time                   start_;       // First sample
+  mono_time                   last_;        // Previous sample
+  off_t                       offset_;      // Offset at the previous sample
+  mono_time                   stall_start_; // Last change of offset
+  bool                        closed_;
+  uint64_t                    reported_;    // Dropped samples reported
+
+  void run();
+  void end_stall(const mono_time& now);
+
+public:
+  // Trace fd of pid, rate samples per second
+  fd_trace(pid_t pid, int fd, unsigned rate, double stall, std::ostream& os);
+  ~fd_trace();
+  fd_trace(const fd_trace&) = delete;
+  fd_trace& operator=(const fd_trace&) = delete;
+
+  // Empty if the trace is running, otherwise an error message
+  const std::string& error() const { return error_; }
+  // True once the descriptor was found closed
+  bool closed() const { return closed_; }
+  // Write the samples queued since the previous call
+  void drain();
+};
+
+#endif /* __FD_TRACE_H__ */
@@ -0,0 +1,36 @@
+#include <sys/stat.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include <src/file_filter.hpp>
+
+file_filter::file_filter(const std::vector<const char*>& include, const std::vector<const char*>& exclude,
+                         const std::vector<const char*>& mounts, off_t min_size, bool regex)
+  : min_size_(min_size)
+{
+  const auto mode = regex ? cmd_matcher::REGEX : cmd_matcher::GLOB;
+  if(!include.empty()) {
+    include_.reset(new cmd_matcher(include, mode));
+    error_ = include_->error();
+  }
+  if(!exclude.empty() && error_.empty()) {
+    exclude_.reset(new cmd_matcher(exclude, mode));
+    error_ = exclude_->error();
+  }
+  for(const char* mount : mounts) {
+    struct stat stat_buf;
+    if(stat(mount, &stat_buf) == -1) {
+      error_ = std::string("Invalid mount '") + mount + "': " + strerror(errno);
+      break;
+    }
+    devs_.push_back(stat_buf.st_dev);
+  }
+}
+
+bool file_filter::accept(const char* path, dev_t dev, off_t size) const {
+  if(include_ && !include_->match(path)) return false;
+  if(exclude_ && exclude_->match(path)) return false;
+  if(!devs_.empty() && std::find(devs_.begin(), devs_.end(), dev) == devs_.end()) return false;
+  return size >= min_size_;
+}
@@ -0,0 +1,33 @@
+#ifndef __FILE_FILTER_H__
+#define __FILE_FILTER_H__
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <src/proc.hpp>
+
+// Which files to monitor, decided once when a file is found: its path
+// must match an include pattern (if any) and no exclude pattern, it
+// must be on one of the given mounts (if any) and it must be at least
+// min_size bytes at that time. The updaters cache the verdict per (fd,
+// inode): a rejected file is never sampled nor displayed.
+class file_filter {
+  std::unique_ptr<cmd_matcher> include_;
+  std::unique_ptr<cmd_matcher> exclude_;
+  std::vector<dev_t>           devs_;     // Devices of the mounts
+  const off_t                  min_size_;
+  std::string                  error_;
+
+public:
+  // Patterns are globs, or extended regular expressions if regex is
+  // true. Each mount is a path on the file system to keep.
+  file_filter(const std::vector<const char*>& include, const std::vector<const char*>& exclude,
+              const std::vector<const char*>& mounts, off_t min_size, bool regex = false);
+
+  // Empty if the filter is valid, otherwise an error message
+  const std::string& error() const { return error_; }
+  bool accept(const char* path, dev_t dev, off_t size) const;
+};
+
+#endif /* __FILE_FILTER_H__ */
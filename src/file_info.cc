@@ -14,3 +14,16 @@ std::string create_identifier(bool numeric, pid_t pid) {
   const auto slash = name.find_last_of("/");
   return strpid + ":" + ((slash == std::string::npos) ? name : name.substr(slash + 1));
 }
+
+size_t file_list::archive_closed(size_t keep) {
+  const size_t closed = std::count_if(list.begin(), list.end(), [](const file_info& f) { return !f.updated; });
+  if(closed <= keep) return 0;
+  // The files are in the order found: archive the oldest first
+  size_t nb = closed - keep;
+  return remove_if([&](const file_info& f) {
+      if(f.updated || nb == 0) return false;
+      archive.add(f);
+      --nb;
+      return true;
+    });
+}
@@ -5,12 +5,17 @@
 #include <string>
 #include <algorithm>
 #include <memory>
+#include <unordered_map>
+
+#include <src/pidfd.hpp>
+#include <src/mono_time.hpp>
+#include <src/path_pool.hpp>
 
 // Information kept about one file
 struct file_info {
   int             fd;
   ino_t           inode;
-  std::string     name;
+  interned_path   name;
   off_t           offset;
   off_t           ooffset;
   off_t           size;
@@ -18,8 +23,14 @@ struct file_info {
   double          speed;
   double          average;
   bool            updated;
-  struct timespec stamp;
-  struct timespec start;
+  mono_time       stamp;
+  mono_time       start;
+  int             wd = -1; // Inotify watch descriptor
+  dev_t           dev = 0; // Device, for the filter
+  // Open file description shared with other processes (shared_files):
+  // sampled and displayed by the process owner, 0 if not shared
+  pid_t           owner = 0;
+  std::shared_ptr<const std::vector<pid_t>> sharers; // The other processes, if displayed here
 };
 // A file is uniquely indexed by the pair (fd, inode)
 struct find_file {
@@ -40,8 +51,8 @@ struct speed {
 };
 
 struct io_info {
-  struct timespec stamp;
-  struct timespec start;
+  mono_time stamp;
+  mono_time start;
   rw char_counter, ochar_counter;
   speed char_speed, char_avg;
   rw sys_counter, osys_counter;
@@ -49,23 +60,71 @@ struct io_info {
   rw io_counter, oio_counter;
   speed io_speed, io_avg;
   size_t dead_count;
-  io_info() : stamp({0, 0}), start({0, 0}), dead_count(0) { }
+  io_info()
+    : stamp(), start()
+    , char_counter(), ochar_counter(), char_speed(), char_avg()
+    , sys_counter(), osys_counter(), sys_speed(), sys_avg()
+    , io_counter(), oio_counter(), io_speed(), io_avg()
+    , dead_count(0)
+  { }
 };
-typedef std::vector<io_info> io_info_list;
 
 
+// Totals of the closed files archived out of a file_list. Their
+// average rate is moved / seconds.
+struct file_archive {
+  size_t files   = 0;
+  off_t  bytes   = 0; // Sum of the final offsets
+  off_t  moved   = 0; // Bytes read or written while sampled
+  double seconds = 0; // Time sampled, from the first to the last sample
+  void add(const file_info& f) {
+    ++files;
+    bytes += f.offset;
+    if(f.start == mono_time()) return; // Never sampled
+    moved   += f.offset - f.ooffset;
+    seconds += to_seconds(f.stamp - f.start);
+  }
+  double rate() const { return seconds > 0 ? moved / seconds : 0; }
+};
+
 class file_info_updater;
+// Files of a process, in the order they were found. An index from fd
+// to the last file with this fd makes find O(1) for the open files.
 struct file_list {
   typedef std::vector<file_info>    list_type;
   typedef list_type::iterator       iterator;
   typedef list_type::const_iterator const_iterator;
 
-  list_type          list;
+  list_type                       list;
+  std::unordered_map<int, size_t> fds;
+  file_archive                    archive;
+
+  iterator find(int fd, ino_t inode) {
+    auto it = fds.find(fd);
+    if(it == fds.end()) return list.end();
+    if(list[it->second].inode == inode) return list.begin() + it->second;
+    // An older file closed since, with the same fd
+    return std::find_if(list.begin(), list.end(), find_file(fd, inode));
+  }
+
+  // Remove the files for which pred is true, and rebuild the index
+  template<typename Pred>
+  size_t remove_if(Pred pred) {
+    auto         it  = std::remove_if(list.begin(), list.end(), pred);
+    const size_t res = list.end() - it;
+    list.erase(it, list.end());
+    fds.clear();
+    for(size_t i = 0; i < list.size(); ++i)
+      fds[list[i].fd] = i;
+    return res;
+  }
 
-  iterator find(int fd, ino_t inode) { return std::find_if(list.begin(), list.end(), find_file(fd, inode)); }
+  // Move the closed files, but the last keep ones, to the archive.
+  // Return the number of files archived.
+  size_t archive_closed(size_t keep);
 
-  void push_back(file_info&& f) { list.push_back(std::move(f)); }
-  void push_back(const file_info& f) { list.push_back(f); }
+  void push_back(file_info&& f) { fds[f.fd] = list.size(); list.push_back(std::move(f)); }
+  void push_back(const file_info& f) { fds[f.fd] = list.size(); list.push_back(f); }
   iterator back_iterator() { return list.end() - 1; }
   iterator begin() { return list.begin(); }
   iterator end() { return list.end(); }
@@ -73,22 +132,41 @@ struct file_list {
   const_iterator end() const { return list.end(); }
   size_t size() const { return list.size(); }
 };
-typedef std::vector<file_list> list_of_file_list;
 
 std::string create_identifier(bool numeric, pid_t pid);
 
+// Counters of the last update
+struct update_stats {
+  bool   listed;  // The descriptors were listed
+  size_t opened;  // Descriptors found opened
+  size_t closed;  // Descriptors found closed
+  size_t skipped; // Files not read, known unchanged
+  size_t unnamed; // Files closed before their name was needed
+};
+
 class file_info_updater {
   const pid_t       pid_;
-  const std::string strid_;
+  std::string       strid_;
+  const pid_fd      pidfd_; // Guards against pid reuse
+protected:
+  update_stats      stats_;
 public:
-  file_info_updater(pid_t pid) : pid_(pid), strid_("") { }
-  file_info_updater(pid_t pid, const std::string&& s) : pid_(pid), strid_(std::move(s)) { }
+  file_info_updater(pid_t pid) : pid_(pid), strid_(""), pidfd_(pid), stats_() { }
+  file_info_updater(pid_t pid, const std::string&& s) : pid_(pid), strid_(std::move(s)), pidfd_(pid), stats_() { }
+  virtual ~file_info_updater() { }
   const std::string& strid() const { return strid_; }
-  virtual bool update_file_info(file_list& list, const timespec& stamp) = 0;
-  virtual bool update_io_info(io_info& info, const timespec& stamp) = 0;
+  void strid(std::string&& s) { strid_ = std::move(s); }
+  virtual bool update_file_info(file_list& list, const mono_time& stamp) = 0;
+  virtual bool update_io_info(io_info& info, const mono_time& stamp) = 0;
+  // Fill in the names left empty by update_file_info, before the files
+  // are displayed. Nothing to do if the names are found with the files.
+  virtual bool resolve_names(file_list& list, const mono_time& stamp) { return true; }
   pid_t pid() const { return pid_; }
+  const pid_fd& pidfd() const { return pidfd_; }
+  const update_stats& stats() const { return stats_; }
+  // True if the process is known to have exited
+  bool exited() const { return pidfd_.exited(); }
 };
 typedef std::unique_ptr<file_info_updater> updater_ptr;
-typedef std::vector<updater_ptr>           updater_list_type;
 
 #endif
@@ -0,0 +1,72 @@
+#include <unistd.h>
+#include <errno.h>
+#include <config.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
+#include <src/inotify_watches.hpp>
+
+#ifdef HAVE_SYS_INOTIFY_H
+inotify_watches::inotify_watches()
+  : fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+  , polls_(0)
+  , overflow_(0)
+{ }
+
+int inotify_watches::add(const char* path) {
+  if(fd_ == -1) return -1;
+  const int wd = inotify_add_watch(fd_, path, IN_ACCESS | IN_MODIFY | IN_CLOSE);
+  if(wd == -1) return -1;
+  auto res = watches_.insert({ wd, { 0, polls_ + 1 } }); // Changed until next poll
+  ++res.first->second.refs;
+  return wd;
+}
+
+void inotify_watches::release(int wd) {
+  auto it = watches_.find(wd);
+  if(it == watches_.end() || --it->second.refs > 0) return;
+  watches_.erase(it);
+  inotify_rm_watch(fd_, wd); // Fails if already removed by the kernel
+}
+
+uint64_t inotify_watches::poll() {
+  if(fd_ == -1) return polls_;
+  ++polls_;
+  alignas(inotify_event) char buf[16384];
+  ssize_t                     len;
+  while((len = read(fd_, buf, sizeof(buf))) > 0 || (len == -1 && errno == EINTR)) {
+    for(char* ptr = buf; ptr < buf + len; ) {
+      const inotify_event* ev = (const inotify_event*)ptr;
+      ptr += sizeof(inotify_event) + ev->len;
+      if(ev->mask & IN_Q_OVERFLOW) {
+        overflow_ = polls_;
+        continue;
+      }
+      auto it = watches_.find(ev->wd);
+      if(it == watches_.end()) continue;
+      if(ev->mask & IN_IGNORED) // Watch removed: file deleted or unmounted
+        watches_.erase(it);
+      else
+        it->second.last = polls_;
+    }
+  }
+  return polls_;
+}
+#else
+inotify_watches::inotify_watches() : fd_(-1), polls_(0), overflow_(0) { }
+int inotify_watches::add(const char* path) { return -1; }
+void inotify_watches::release(int wd) { }
+uint64_t inotify_watches::poll() { return polls_; }
+#endif
+
+inotify_watches::~inotify_watches() {
+  if(fd_ != -1)
+    close(fd_);
+}
+
+bool inotify_watches::changed(int wd, uint64_t since) const {
+  if(overflow_ > since) return true;
+  auto it = watches_.find(wd);
+  return it == watches_.end() || it->second.last > since;
+}
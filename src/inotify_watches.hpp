@@ -0,0 +1,44 @@
+#ifndef __INOTIFY_WATCHES_H__
+#define __INOTIFY_WATCHES_H__
+
+#include <cstdint>
+#include <unordered_map>
+
+// Inotify watches on the monitored files, shared by all the
+// processes. A file whose watch received no event (read, write or
+// close) since an update has the same offset, and its fdinfo need not
+// be read again. Lseek(2) is not reported by inotify: a file
+// repositioned but not read is seen unchanged until its next access.
+//
+// The watches are reference counted, as the same file may be open
+// many times. If inotify is not available (good() is false), or if a
+// file cannot be watched (add() returns -1), the files are polled.
+class inotify_watches {
+  struct watch {
+    size_t   refs;
+    uint64_t last; // Last poll with an event
+  };
+  int                            fd_;
+  uint64_t                       polls_;
+  uint64_t                       overflow_; // Last poll with lost events
+  std::unordered_map<int, watch> watches_;
+
+public:
+  inotify_watches();
+  ~inotify_watches();
+  inotify_watches(const inotify_watches&) = delete;
+  inotify_watches& operator=(const inotify_watches&) = delete;
+
+  bool good() const { return fd_ != -1; }
+
+  // Watch path. Return the watch descriptor, or -1
+  int add(const char* path);
+  // Remove a reference to the watch
+  void release(int wd);
+  // Read the pending events. Return the number of this poll
+  uint64_t poll();
+  // True if the watch wd may have had an event after poll number since
+  bool changed(int wd, uint64_t since) const;
+};
+
+#endif /* __INOTIFY_WATCHES_H__ */
@@ -1,29 +1,49 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
 #include <iostream>
+#include <charconv>
+#include <algorithm>
 #include <config.h>
 #include <src/pipe_open.hpp>
 #include <src/lsof.hpp>
 #include <src/file_info.hpp>
+#include <src/file_filter.hpp>
+#include <src/tick_arena.hpp>
 
 
-bool lsof_file_info::parse_line(std::string& line, file_info& f, bool& failed) {
-  const char* ptr = line.c_str();
-  const char* const end = ptr + line.size();
-  int fields;
+// Parse an integer field of lsof. Offsets may be prefixed by 0t
+// (decimal) or 0x (hexadecimal). The whole field must be consumed.
+template<typename T>
+static bool parse_number(const char* ptr, const char* end, T& value) {
+  int base = 10;
+  if(end - ptr > 2 && ptr[0] == '0' && (ptr[1] == 't' || ptr[1] == 'x')) {
+    base = ptr[1] == 'x' ? 16 : 10;
+    ptr += 2;
+  }
+  auto res = std::from_chars(ptr, end, value, base);
+  return res.ec == std::errc() && res.ptr == end;
+}
 
+bool lsof_parser::parse_line(const char* ptr, const char* const end, file_info& f, bool& failed) {
   failed = false;
   while(ptr < end) {
+    const char* field_end = (const char*)memchr(ptr, '\0', end - ptr);
+    if(!field_end) field_end = end;
+
     switch(*ptr) {
     case 'f': // Get file descriptor
-      if(strcmp("fNOFD", ptr) == 0) {
+      if(field_end - ptr == 5 && !memcmp("fNOFD", ptr, 5)) {
         failed = true;
         return false;
       }
-      fields = sscanf(ptr, "f%d", &f.fd);
-      if(fields != 1) return false;
+      if(!parse_number(ptr + 1, field_end, f.fd)) return false;
       break;
 
     case 't': // Accept only regular file
-      if(strcmp("tREG", ptr)) return false;
+      if(field_end - ptr != 4 || memcmp("tREG", ptr, 4)) return false;
       break;
 
     case 'a': // Get access rights. Writable and read/write are the same
@@ -39,118 +59,358 @@ bool lsof_file_info::parse_line(std::string& line, file_info& f, bool& failed) {
       break;
 
     case 'o': // Get offset
-      fields = sscanf(ptr, "o0t%ld", &f.offset);
-      if(fields != 1) {
-        fields = sscanf(ptr, "o%li", &f.offset);
-        if(fields != 1) return false;
-      }
+      if(!parse_number(ptr + 1, field_end, f.offset)) return false;
       break;
 
     case 's': // Get size
-      fields = sscanf(ptr, "s%ld", &f.size);
-      if(fields != 1) return false;
+      if(!parse_number(ptr + 1, field_end, f.size)) return false;
       break;
 
     case 'i': // Get inode
-      fields = sscanf(ptr, "i%li", &f.inode);
-      if(fields != 1) return false;
+      if(!parse_number(ptr + 1, field_end, f.inode)) return false;
+      break;
+
+    case 'D': // Get device
+      if(!parse_number(ptr + 1, field_end, f.dev)) return false;
       break;
 
     case 'n': // Get name
-      f.name.assign(ptr + 1);
+      f.name = std::string_view(ptr + 1, field_end - ptr - 1);
       break;
 
     default:
       return false;
     }
 
-    ptr += strlen(ptr) + 1;
+    ptr = field_end + 1;
   }
 
   return true;
 }
 
-bool lsof_file_info::update_file_info(file_list& list, const timespec& stamp) {
-  const char* cmd[] = { LSOF, "-p", pid_str_.c_str(), "-o0", "-o", "-Fftiao0", 0 };
-  pipe_open offsets_pipe(cmd, true, true);
-  bool need_updated_name = false;
+void lsof_parser::parse_one(const char* ptr, const char* end) {
+  if(end - ptr > 1 && *ptr == 'p') {
+    pid_t pid;
+    const char* pid_end = (const char*)memchr(ptr, '\0', end - ptr);
+    if(!parse_number(ptr + 1, pid_end ? pid_end : end, pid)) return;
+    current_ = &sections_[pid];
+    current_->stamp = mono_now();
+    return;
+  }
+  if(!current_) return; // Junk before the first process (e.g. warnings)
+
+  file_info f = file_info();
+  bool failed = false;
+  if(parse_line(ptr, end, f, failed))
+    current_->files.push_back(std::move(f));
+  else if(failed)
+    current_->failed = true;
+}
+
+void lsof_parser::parse(size_t len) {
+  const char*       ptr = buffer_.data();
+  const char* const end = ptr + used_ + len;
+  // Search for the new line only in the new data
+  const char*       nl  = (const char*)memchr(ptr + used_, '\n', len);
+  for( ; nl; nl = (const char*)memchr(ptr, '\n', end - ptr)) {
+    parse_one(ptr, nl);
+    ptr = nl + 1;
+  }
+  used_ = end - ptr;
+  if(used_ > 0 && ptr != buffer_.data())
+    memmove(buffer_.data(), ptr, used_);
+  if(used_ == buffer_.size()) // Line longer than the buffer
+    buffer_.resize(2 * buffer_.size());
+}
+
+ssize_t lsof_parser::read(int fd) {
+  ssize_t len;
+  do {
+    len = ::read(fd, buffer_.data() + used_, buffer_.size() - used_);
+  } while(len == -1 && errno == EINTR);
+  if(len > 0)
+    parse(len);
+  else if(len == 0)
+    finish();
+  return len;
+}
+
+bool lsof_parser::read_all(int fd) {
+  ssize_t len;
+  while((len = read(fd)) > 0) ;
+  return len == 0;
+}
 
-  bool return_status = update_file_info(offsets_pipe, list, stamp, need_updated_name);
-  if(return_status && need_updated_name)
-    return_status = update_file_names(list);
+void lsof_parser::feed(const char* data, size_t len) {
+  while(len > 0) {
+    const size_t chunk = std::min(len, buffer_.size() - used_);
+    memcpy(buffer_.data() + used_, data, chunk);
+    parse(chunk);
+    data += chunk;
+    len  -= chunk;
+  }
+}
 
-  auto status = offsets_pipe.status();
-  return_status = return_status &&
-    status.first == 0 &&
-    WIFEXITED(status.second) &&
-    WEXITSTATUS(status.second) == 0;
+void lsof_parser::finish() {
+  if(used_ > 0)
+    parse_one(buffer_.data(), buffer_.data() + used_);
+  used_    = 0;
+  current_ = nullptr;
+}
+
+bool lsof_file_info::update_file_info(file_list& list, const mono_time& stamp) {
+  const lsof_section* section = batch_->offsets(pid(), stamp);
+  if(!section) return false;
+  bool need_updated_name = false;
+
+  bool return_status = update_file_info(*section, list, stamp, need_updated_name);
+  names_pending_ = names_pending_ || need_updated_name;
+  // The filter needs the names now, otherwise wait for the display
+  if(return_status && names_pending_ && filter_)
+    return_status = resolve_names(list, stamp);
   return return_status;
 }
 
-bool lsof_file_info::update_file_info(std::istream& is, file_list& list, const timespec& stamp, bool& need_updated_name) {
-  std::string line;
+bool lsof_file_info::resolve_names(file_list& list, const mono_time& stamp) {
+  if(!names_pending_) return true;
+  // Still pending if lsof failed: tried again at the next update
+  const bool res = update_file_names(list, stamp);
+  names_pending_ = !res;
+  // Closed before being named: lsof can no longer find the name
+  list.remove_if([](const file_info& file) { return !file.updated && file.name.empty(); });
+  return res;
+}
 
-  for(auto it = list.begin(); it != list.end(); ++it)
+bool lsof_file_info::update_file_info(const lsof_section& section, file_list& list, const mono_time& stamp, bool& need_updated_name) {
+  // Files open at the previous update, to count the ones closed since
+  std::pmr::vector<char> was_open(tick_arena::instance().resource());
+  was_open.reserve(list.size());
+  for(auto it = list.begin(); it != list.end(); ++it) {
+    was_open.push_back(it->updated);
     it->updated = false;
+  }
 
+  stats_            = update_stats();
   need_updated_name = false;
-  while(std::getline(is, line)) {
-    file_info f;
-    f.offset = f.size = 0;
-    bool failed = false;
-    if(!parse_line(line, f, failed)) {
-      if(failed)
-        return false;
+  if(section.failed)
+    return false;
+  stats_.listed = true;
+  ++listings_;
+  // lsof read the offsets of this process about when its section was
+  // output, not at the start of the tick.
+  const mono_time& sample = section.stamp != mono_time() ? section.stamp : stamp;
+  for(const auto& f : section.files) {
+    auto filtered = filtered_.find(f.fd);
+    if(filtered != filtered_.end() && filtered->second.inode == f.inode) {
+      filtered->second.listing = listings_;
       continue;
     }
     auto cfile = list.find(f.fd, f.inode);
     if(cfile == list.end()) {
       // Append new entry
       need_updated_name = true;
-      f.updated         = true;
-      f.stamp           = stamp;
+      ++stats_.opened;
       list.push_back(f);
+      list.back_iterator()->updated = true;
+      list.back_iterator()->stamp   = sample;
       continue;
     }
     // Update existing entry
-    cfile->speed   = (f.offset - cfile->offset) / timespec_double(stamp - (cfile->stamp));
+    cfile->speed   = (f.offset - cfile->offset) / to_seconds(sample - cfile->stamp);
     cfile->offset  = f.offset;
     cfile->updated = true;
-    cfile->stamp   = stamp;
+    cfile->stamp   = sample;
+  }
+  for(size_t i = 0; i < was_open.size(); ++i) {
+    if(!was_open[i] || list.list[i].updated) continue;
+    ++stats_.closed;
+    stats_.unnamed += list.list[i].name.empty();
   }
 
+  // Forget the filtered descriptors closed
+  for(auto it = filtered_.begin(); it != filtered_.end(); ) {
+    if(it->second.listing != listings_)
+      it = filtered_.erase(it);
+    else
+      ++it;
+  }
   return true;
 }
 
-bool lsof_file_info::update_file_names(file_list& list) {
-  const char* cmd[] = { LSOF, "-p", pid_str_.c_str(), "-s", "-Ffiasn0", 0 };
-  pipe_open names_pipe(cmd, true, true);
-  bool return_status = update_file_names(names_pipe, list);
-
-  auto status = names_pipe.status();
-  return return_status &&
-    status.first == 0 &&
-    WIFEXITED(status.second) &&
-    WEXITSTATUS(status.second) == 0;
+bool lsof_file_info::update_file_names(file_list& list, const mono_time& stamp) {
+  const lsof_section* section = batch_->names(pid(), stamp);
+  if(!section) return false;
+  return update_file_names(*section, list);
 }
 
-bool lsof_file_info::update_file_names(std::istream& is, file_list& list) {
-  std::string line;
-  while(std::getline(is, line)) {
-    file_info f;
-    f.offset = f.size = 0;
-    bool failed;
-    if(!parse_line(line, f, failed)) {
-      if(failed)
-        return false;
-      continue;
-    }
+bool lsof_file_info::update_file_names(const lsof_section& section, file_list& list) {
+  if(section.failed)
+    return false;
+  bool filtered = false;
+  for(const auto& f : section.files) {
     auto cfile = list.find(f.fd, f.inode);
     if(cfile == list.end())
       continue;
+    const bool is_new = cfile->name.empty();
     cfile->size = f.size;
-    cfile->name.swap(f.name);
+    cfile->name = f.name;
+    cfile->dev  = f.dev;
+    // Filter the new files, now that their name is known
+    if(is_new && filter_ && !filter_->accept(f.name.c_str(), f.dev, f.size)) {
+      filtered_[f.fd] = { f.inode, listings_ };
+      filtered        = true;
+    }
+  }
+  if(filtered) {
+    // Not counted opened if found at an earlier update
+    const size_t removed = list.remove_if([&](const file_info& file) {
+        auto it = filtered_.find(file.fd);
+        return it != filtered_.end() && it->second.inode == file.inode;
+      });
+    stats_.opened -= std::min(stats_.opened, removed);
   }
 
   return true;
 }
+
+std::string lsof_batch::pid_list() const {
+  std::string res;
+  for(const auto pid : pids_) {
+    if(!res.empty())
+      res += ',';
+    res += std::to_string(pid);
+  }
+  return res;
+}
+
+// The exit status of lsof is not checked: it is non-zero as soon as
+// one of the pids does not exist, even if the others are fine. A dead
+// process is detected by the absence of its section.
+bool lsof_batch::run_all(const char* const cmd[], lsof_sections& sections) {
+  pipe_open   lsof_pipe(cmd, true, true);
+  lsof_parser parser(sections);
+  const bool  read_ok = parser.read_all(lsof_pipe.first);
+  auto status = lsof_pipe.status();
+  return read_ok && status.first == 0 && WIFEXITED(status.second);
+}
+
+namespace {
+// One lsof run for one pid
+struct lsof_job {
+  pid_t       target;
+  size_t      order; // Launched order-th in this run
+  fd_pid      proc;
+  lsof_parser parser;
+  lsof_job(pid_t t, size_t o, fd_pid p, lsof_sections& sections)
+    : target(t), order(o), proc(p), parser(sections, 64 * 1024) { }
+  ~lsof_job() {
+    close(proc.first);
+    waitpid(proc.second, nullptr, 0);
+  }
+};
+} // namespace
+
+bool lsof_batch::run_per_pid(const char* cmd[], lsof_sections& sections, pid_t& start) {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(epfd == -1) return false;
+
+  const mono_time deadline = mono_now() + from_seconds(timeout_);
+
+  // The pids in turn from start, wrapping around
+  std::map<int, std::unique_ptr<lsof_job>> running; // Indexed by fd
+  auto        next     = pids_.lower_bound(start);
+  size_t      launched = 0;
+  bool        res      = true;
+  std::string pid_str;
+  epoll_event events[16];
+  auto advance = [&]() { ++launched; if(++next == pids_.cend()) next = pids_.cbegin(); };
+
+  while(launched < pids_.size() || !running.empty()) {
+    for( ; launched < pids_.size() && running.size() < jobs_; advance()) {
+      if(next == pids_.cend()) next = pids_.cbegin();
+      pid_str = std::to_string(*next);
+      cmd[2]  = pid_str.c_str();
+      fd_pid proc = open_sub_process(cmd, true, true);
+      if(proc.first == -1) continue;
+      fcntl(proc.first, F_SETFL, O_NONBLOCK);
+      std::unique_ptr<lsof_job> job(new lsof_job(*next, launched, proc, sections));
+      epoll_event ev;
+      ev.events  = EPOLLIN;
+      ev.data.fd = proc.first;
+      if(epoll_ctl(epfd, EPOLL_CTL_ADD, proc.first, &ev) == -1) {
+        kill(proc.second, SIGKILL); // Not waited for forever by ~lsof_job
+        continue;
+      }
+      running[proc.first] = std::move(job);
+    }
+
+    const mono_time now = mono_now();
+    if(!(now < deadline)) break;
+    const int nb = epoll_wait(epfd, events, sizeof(events) / sizeof(epoll_event), timeout_ms(now, deadline));
+    if(nb == -1 && errno != EINTR) {
+      res = false;
+      break;
+    }
+    for(int i = 0; i < nb; ++i) {
+      auto it = running.find(events[i].data.fd);
+      if(it == running.end()) continue;
+      ssize_t len;
+      while((len = it->second->parser.read(it->first)) > 0) ;
+      if(len == -1 && errno == EAGAIN) continue;
+      epoll_ctl(epfd, EPOLL_CTL_DEL, it->first, nullptr);
+      running.erase(it); // Done (or failed). Close and wait on lsof
+    }
+  }
+
+  // Timed out: the next run starts with the first pid not launched, or
+  // else the first one killed, so that no pid is left out at every run
+  if(launched < pids_.size()) {
+    start = next == pids_.cend() ? *pids_.cbegin() : *next;
+  } else if(!running.empty()) {
+    const auto first = std::min_element(running.begin(), running.end(), [](const auto& a, const auto& b) {
+        return a.second->order < b.second->order;
+      });
+    start = first->second->target;
+  }
+
+  // Kill the remaining lsof and forget their partial output
+  for(auto& job : running) {
+    kill(job.second->proc.second, SIGKILL);
+    sections.erase(job.second->target);
+  }
+  running.clear();
+  close(epfd);
+  return res;
+}
+
+bool lsof_batch::run(const char* cmd[], lsof_sections& sections, pid_t& start) {
+  sections.clear();
+  return jobs_ > 0 ? run_per_pid(cmd, sections, start) : run_all(cmd, sections);
+}
+
+const lsof_section* lsof_batch::find(const lsof_sections& sections, pid_t pid) const {
+  auto it = sections.find(pid);
+  return it == sections.end() ? nullptr : &it->second;
+}
+
+const lsof_section* lsof_batch::offsets(pid_t pid, const mono_time& stamp) {
+  if(offsets_stamp_ != stamp) {
+    const std::string pids = pid_list();
+    const char* cmd[] = { LSOF, "-p", pids.c_str(), "-o0", "-o", "-Fftiao0", 0 };
+    offsets_stamp_ = stamp;
+    if(!run(cmd, offsets_, offsets_start_))
+      offsets_.clear();
+  }
+  return find(offsets_, pid);
+}
+
+const lsof_section* lsof_batch::names(pid_t pid, const mono_time& stamp) {
+  if(names_stamp_ != stamp) {
+    const std::string pids = pid_list();
+    const char* cmd[] = { LSOF, "-p", pids.c_str(), "-s", "-FfiasDn0", 0 };
+    names_stamp_ = stamp;
+    if(!run(cmd, names_, names_start_))
+      names_.clear();
+  }
+  return find(names_, pid);
+}
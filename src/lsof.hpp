@@ -7,35 +7,163 @@
 #include <ctime>
 #include <vector>
 #include <string>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
 #include <algorithm>
-#include <src/timespec.hpp>
+#include <src/mono_time.hpp>
 #include <src/file_info.hpp>
 
-class lsof_file_info : public file_info_updater {
-  std::string pid_str_;
+// The files of one process in the output of lsof -F. failed is true if
+// lsof could not list the file descriptors (fNOFD). stamp is the time
+// the section was read, used as the sample time of its files.
+struct lsof_section {
+  bool                   failed;
+  std::vector<file_info> files;
+  mono_time              stamp;
+  lsof_section() : failed(false), stamp() { }
+};
+typedef std::map<pid_t, lsof_section> lsof_sections;
+
+// Incremental parser of the output of lsof -F...0. Data is read
+// directly into a reusable buffer and complete lines are parsed in
+// place. A partial line at the end of the buffer is moved to the front
+// and completed by the next read.
+class lsof_parser {
+  std::vector<char> buffer_;
+  size_t            used_;    // Bytes of partial line at the front of buffer_
+  lsof_sections&    sections_;
+  lsof_section*     current_; // Section of the last 'p' line
+
 public:
-  lsof_file_info(pid_t pid, bool numeric = false)
-    : file_info_updater(pid, create_identifier(numeric, pid))
-    , pid_str_(std::to_string(pid))
+  explicit lsof_parser(lsof_sections& sections, size_t buffer_size = 1024 * 1024)
+    : buffer_(buffer_size)
+    , used_(0)
+    , sections_(sections)
+    , current_(nullptr)
   { }
 
-  // Exec lsof -F on the given pid and update the corresponding list of
-  // file information (mainly the offset).
-  virtual bool update_file_info(file_list& list, const timespec& stamp);
-  virtual bool update_io_info(io_info& info, const timespec& stamp) { /* Not defined */ return true; }
+  // Read once from fd and parse the complete lines. Returns the value
+  // of read(2): 0 on end of file, -1 on error.
+  ssize_t read(int fd);
+  // Read fd until end of file.
+  bool read_all(int fd);
+  // Parse data from memory. Same as if read from a pipe.
+  void feed(const char* data, size_t len);
+  // Parse the last line, if not terminated by a new line.
+  void finish();
+
+  // Parse a line (without the new line) of the output of lsof -F and
+  // fill up f. Return false if the line does not describe a regular
+  // file. failed is set to true if lsof failed to list the files.
+  static bool parse_line(const char* ptr, const char* end, file_info& f, bool& failed);
 
 protected:
-  // Parse a line of the output of lsof -F and fill up f
-  bool parse_line(std::string& line, file_info& f, bool& failed);
+  // Parse the complete lines in the first used_ + len bytes of the
+  // buffer and keep the last partial line.
+  void parse(size_t len);
+  void parse_one(const char* ptr, const char* end);
+};
+
+// Run lsof once per tick for all the registered pids, instead of once
+// per pid, and split the output into one section per pid (the lines
+// following a 'p' line). Shared by all the lsof_file_info of a run.
+//
+// If jobs > 0, lsof is instead run separately for each pid, with at
+// most jobs lsof running concurrently. Their outputs are read as they
+// come (multiplexed with epoll) and the runs not finished after
+// timeout seconds are killed: a tick takes as long as the slowest lsof
+// run, not the sum of all of them. The next run then starts with the
+// first pid not launched, or else the first one killed, so that no pid
+// is left out at every tick.
+class lsof_batch {
+  std::set<pid_t> pids_;
+  lsof_sections   offsets_;
+  mono_time       offsets_stamp_;
+  pid_t           offsets_start_; // First pid of the next run with jobs
+  lsof_sections   names_;
+  mono_time       names_stamp_;
+  pid_t           names_start_;
+  const unsigned  jobs_;
+  const double    timeout_;
+
+public:
+  explicit lsof_batch(unsigned jobs = 0, double timeout = 1.0)
+    : offsets_stamp_()
+    , offsets_start_(0)
+    , names_stamp_()
+    , names_start_(0)
+    , jobs_(jobs)
+    , timeout_(timeout)
+  { }
+
+  void add(pid_t pid) { pids_.insert(pid); offsets_stamp_ = names_stamp_ = mono_time(); }
+  void remove(pid_t pid) { pids_.erase(pid); offsets_.erase(pid); names_.erase(pid); }
 
-  // Update list of file information from input stream (most likely a
-  // pipe from lsof -F).
-  bool update_file_info(std::istream& is, file_list& list, const timespec& stamp, bool& need_updated_name);
+  // Files of pid from lsof -Fftiao0 (offsets) or lsof -FfiasDn0 (sizes,
+  // devices and names). lsof is run only on the first call for a given
+  // stamp. Returns nullptr if pid is not in the output (e.g. the
+  // process is dead or lsof timed out).
+  const lsof_section* offsets(pid_t pid, const mono_time& stamp);
+  const lsof_section* names(pid_t pid, const mono_time& stamp);
+
+protected:
+  std::string pid_list() const;
+  // Run lsof, cmd[2] being the argument of -p. With jobs, the pids are
+  // run in turn from start, updated to the first pid not done. Returns
+  // false on error.
+  bool run(const char* cmd[], lsof_sections& sections, pid_t& start);
+  bool run_all(const char* const cmd[], lsof_sections& sections);
+  bool run_per_pid(const char* cmd[], lsof_sections& sections, pid_t& start);
+  const lsof_section* find(const lsof_sections& sections, pid_t pid) const;
+};
+
+class file_filter;
+
+// Files of a process from lsof. The names of the new files need a
+// second lsof run, done only when a filter is set or when the files are
+// displayed (resolve_names). A new file is filtered when its name is
+// known, and the files rejected are remembered per (fd, inode) to be
+// skipped in the next updates.
+class lsof_file_info : public file_info_updater {
+  struct filtered_file {
+    ino_t    inode;
+    uint64_t listing; // Last update which found the descriptor
+  };
+  std::shared_ptr<lsof_batch>            batch_;
+  std::shared_ptr<const file_filter>     filter_;   // nullptr for all files
+  std::unordered_map<int, filtered_file> filtered_;
+  uint64_t                               listings_;
+  bool                                   names_pending_; // New files not named yet
+public:
+  // If batch is null, lsof is run for this pid alone.
+  lsof_file_info(pid_t pid, bool numeric = false, std::shared_ptr<lsof_batch> batch = nullptr,
+                 std::shared_ptr<const file_filter> filter = nullptr)
+    : file_info_updater(pid, create_identifier(numeric, pid))
+    , batch_(batch ? batch : std::make_shared<lsof_batch>())
+    , filter_(std::move(filter))
+    , listings_(0)
+    , names_pending_(false)
+  {
+    batch_->add(pid);
+  }
+  virtual ~lsof_file_info() { batch_->remove(pid()); }
+
+  // Get the lsof -F output for the pid and update the corresponding
+  // list of file information (mainly the offset).
+  virtual bool update_file_info(file_list& list, const mono_time& stamp);
+  virtual bool update_io_info(io_info& info, const mono_time& stamp) { /* Not defined */ return true; }
+  virtual bool resolve_names(file_list& list, const mono_time& stamp);
+
+protected:
+  // Update list of file information from the parsed output of lsof -F.
+  bool update_file_info(const lsof_section& section, file_list& list, const mono_time& stamp, bool& need_updated_name);
 
-  // Exec lsof -F to get the file size and name information.
-  bool update_file_names(file_list& list);
-  // Update list from input stream
-  bool update_file_names(std::istream& is, file_list& list);
+  // Get the file size and name information from lsof -F.
+  bool update_file_names(file_list& list, const mono_time& stamp);
+  // Update list from the parsed output
+  bool update_file_names(const lsof_section& section, file_list& list);
 };
 
 #endif
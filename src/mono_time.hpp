@@ -0,0 +1,40 @@
+#ifndef __MONO_TIME_H__
+#define __MONO_TIME_H__
+
+#include <time.h>
+#include <chrono>
+#include <type_traits>
+
+// Monotonic time (CLOCK_MONOTONIC) as a 64 bit integer number of
+// nanoseconds. Time differences are exact integer operations: floating
+// point is used only to compute rates.
+typedef std::chrono::steady_clock mono_clock;
+typedef mono_clock::duration      mono_duration;
+typedef mono_clock::time_point    mono_time;
+static_assert(std::is_same<mono_duration, std::chrono::nanoseconds>::value,
+              "steady_clock must count nanoseconds");
+
+inline mono_time mono_now() { return mono_clock::now(); }
+
+// Duration in seconds
+inline double to_seconds(mono_duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+inline mono_duration from_seconds(double s) {
+  return std::chrono::duration_cast<mono_duration>(std::chrono::duration<double>(s));
+}
+
+// Absolute time for clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, ...)
+inline timespec to_timespec(mono_time t) {
+  const auto ns = t.time_since_epoch().count();
+  return { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+}
+
+// Timeout in milliseconds for poll(2) and epoll_wait(2) to wait until
+// deadline, rounded up to not wake up early. 0 if already passed.
+inline int timeout_ms(mono_time now, mono_time deadline) {
+  if(!(now < deadline)) return 0;
+  return (deadline - now + std::chrono::milliseconds(1) - mono_duration(1)) / std::chrono::milliseconds(1);
+}
+
+#endif /* __MONO_TIME_H__ */
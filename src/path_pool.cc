@@ -0,0 +1,23 @@
+#include <src/path_pool.hpp>
+
+const std::string interned_path::empty_;
+
+path_pool& path_pool::instance() {
+  static path_pool* pool = new path_pool;
+  return *pool;
+}
+
+std::shared_ptr<const std::string> path_pool::intern(std::string_view path) {
+  auto it = paths_.find(path);
+  if(it != paths_.end())
+    return it->second.lock();
+
+  // The last reference removes the path from the pool, before the key
+  // it points to is freed.
+  std::shared_ptr<const std::string> res(new std::string(path), [this](const std::string* s) {
+      paths_.erase(std::string_view(*s));
+      delete s;
+    });
+  paths_.emplace(std::string_view(*res), res);
+  return res;
+}
@@ -0,0 +1,62 @@
+#ifndef __PATH_POOL_H__
+#define __PATH_POOL_H__
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+
+// Pool of the file paths of all the processes. With -F, many processes
+// open the same files: each path is stored once, and the file_info
+// share it. A path is freed when its last reference goes away.
+//
+// Not thread safe: the file lists are updated from the main loop only.
+class path_pool {
+  std::unordered_map<std::string_view, std::weak_ptr<const std::string>> paths_;
+
+  path_pool() = default;
+public:
+  path_pool(const path_pool&) = delete;
+  path_pool& operator=(const path_pool&) = delete;
+
+  // The pool of the program. Never destroyed, as paths may outlive
+  // the static objects.
+  static path_pool& instance();
+
+  // Shared copy of path. Looking up a known path does not allocate.
+  std::shared_ptr<const std::string> intern(std::string_view path);
+  // Number of distinct paths
+  size_t size() const { return paths_.size(); }
+};
+
+// A path from the pool. Copying is a reference count increment, and
+// equal paths compare by pointer.
+class interned_path {
+  std::shared_ptr<const std::string> path_;
+  static const std::string empty_;
+
+public:
+  interned_path() = default;
+  interned_path(std::string_view path) : path_(path.empty() ? nullptr : path_pool::instance().intern(path)) { }
+  interned_path(const char* path) : interned_path(std::string_view(path)) { }
+  interned_path(const std::string& path) : interned_path(std::string_view(path)) { }
+
+  const std::string& str() const { return path_ ? *path_ : empty_; }
+  operator const std::string&() const { return str(); }
+  const char* c_str() const { return str().c_str(); }
+  size_t size() const { return str().size(); }
+  bool empty() const { return !path_; }
+
+  bool operator==(const interned_path& rhs) const { return path_ == rhs.path_; }
+  bool operator!=(const interned_path& rhs) const { return path_ != rhs.path_; }
+  bool operator==(const char* rhs) const { return str() == rhs; }
+  bool operator!=(const char* rhs) const { return str() != rhs; }
+  bool operator==(const std::string& rhs) const { return str() == rhs; }
+  bool operator!=(const std::string& rhs) const { return str() != rhs; }
+};
+inline bool operator==(const char* lhs, const interned_path& rhs) { return rhs == lhs; }
+inline bool operator==(const std::string& lhs, const interned_path& rhs) { return rhs == lhs; }
+inline std::ostream& operator<<(std::ostream& os, const interned_path& path) { return os << path.str(); }
+
+#endif /* __PATH_POOL_H__ */
@@ -0,0 +1,27 @@
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+
+#include <src/pidfd.hpp>
+
+#ifdef SYS_pidfd_open
+pid_fd::pid_fd(pid_t pid)
+  : fd_(pid > 0 ? syscall(SYS_pidfd_open, pid, 0) : -1)
+{ }
+#else
+pid_fd::pid_fd(pid_t pid) : fd_(-1) { }
+#endif
+
+pid_fd::~pid_fd() {
+  if(fd_ != -1)
+    close(fd_);
+}
+
+bool pid_fd::wait(int timeout_ms) const {
+  if(fd_ == -1) return false;
+  pollfd pfd = { fd_, POLLIN, 0 };
+  int    res;
+  while((res = poll(&pfd, 1, timeout_ms)) == -1 && errno == EINTR) ;
+  return res == 1 && (pfd.revents & POLLIN);
+}
@@ -0,0 +1,30 @@
+#ifndef __PIDFD_H__
+#define __PIDFD_H__
+
+#include <sys/types.h>
+
+// File descriptor referring to a process (pidfd_open(2)). Unlike the
+// pid, it cannot end up referring to another process after the
+// process exits and its pid is reused: it becomes readable when the
+// process exits. On kernels without pidfd (before 5.3), good() is
+// false and the process is never seen as exited.
+class pid_fd {
+  int fd_;
+
+public:
+  explicit pid_fd(pid_t pid);
+  ~pid_fd();
+  pid_fd(const pid_fd&) = delete;
+  pid_fd& operator=(const pid_fd&) = delete;
+
+  bool good() const { return fd_ != -1; }
+  int fd() const { return fd_; }
+
+  // True if the process has exited
+  bool exited() const { return wait(0); }
+  // Wait at most timeout_ms milliseconds for the process to
+  // exit. Return true if it has exited.
+  bool wait(int timeout_ms) const;
+};
+
+#endif /* __PIDFD_H__ */
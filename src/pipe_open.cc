@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -14,78 +15,55 @@
 
 #include <src/pipe_open.hpp>
 
-/** Close the read pipe, set stdout to the write pipe and exec the
-    command. If merge_stderr is true, stderr is merged with stdout.
- */
-typedef char *const *execvp_argv;
-int exec_command(int pipe_fd[2], const char* const cmd[], bool merge_stderr) {
-  if(close(pipe_fd[0]) == -1) return errno;
-  if(dup2(pipe_fd[1], 1) == -1) return errno;
-  if(merge_stderr)
-    if(dup2(pipe_fd[1], 2) == -1) return errno;
-  execvp(cmd[0], (execvp_argv)cmd);
-  return errno;
-}
+typedef char *const *spawn_argv;
 
-/** Execute a sub-command (without any shell) and return a file
-    descriptor connected to its stdout and its pid. In case of
-    error, -1 is returned and errno is set appropriately. The error
-    could come from pipe(2), fork(2), fcntl(2), dup2(2), close(2) or
-    execvp(3).
-*/
-fd_pid open_sub_process(const char* const cmd[], bool check_exec = true,
-                        bool merge_stderr = false) {
-  // pipe to tell whether the exec call worked
-  int exec_worked[2] = { -1, -1 };
-  // pipe connected to sub-command stdout
-  int sub_stdout[2] = { -1, -1 };
-  int     ret, pid;
-  ssize_t child_read;
+pid_t spawn_command(const char* const cmd[], int stdout_fd, bool merge_stderr) {
+  posix_spawn_file_actions_t  actions;
+  posix_spawn_file_actions_t* pactions = nullptr;
+  int                         ret      = 0;
+  pid_t                       pid      = -1;
 
-  if(pipe(sub_stdout) == -1) goto failed;
-  if(check_exec) {
-    if(pipe(exec_worked) == -1) goto failed;
-    if(fcntl(exec_worked[1], F_SETFD, FD_CLOEXEC) == -1) goto failed;
+  if(stdout_fd >= 0) {
+    if((ret = posix_spawn_file_actions_init(&actions))) goto failed;
+    pactions = &actions;
+    if((ret = posix_spawn_file_actions_adddup2(pactions, stdout_fd, 1))) goto failed;
+    if(merge_stderr)
+      if((ret = posix_spawn_file_actions_adddup2(pactions, stdout_fd, 2))) goto failed;
   }
+  ret = posix_spawnp(&pid, cmd[0], pactions, nullptr, (spawn_argv)cmd, environ);
 
-  switch((pid = fork())) {
-  case -1: goto failed;
-  case 0: // Child
-    // If we fail to close the read end of pipe, we cannot report the
-    // error! Simply exit.
-    if(check_exec)
-      if(close(exec_worked[0]) == -1) _exit(1);
-    ret = exec_command(sub_stdout, cmd, merge_stderr);
-    // if reached here, a problem occurred. Send it to parent
-    if(check_exec)
-      // The loop is here to please gcc warning and using the output
-      // of write.
-      while(write(exec_worked[1], &ret, sizeof(ret)) == -1)
-        if(errno != EINTR)
-          break;
-    _exit(1);
-
-  default: // Parent
-    if(close(sub_stdout[1]) == -1) goto failed;
-    if(check_exec) {
-      if(close(exec_worked[1]) == -1) goto failed;
-      child_read = ::read(exec_worked[0], (void*)&ret, sizeof(ret));
-      close(exec_worked[0]);
-      switch(child_read) {
-      case -1: goto failed;
-      case 0: break; // Success
-      default:
-        errno = ret;
-        goto failed;
-      }
-    }
+ failed:
+  if(pactions)
+    posix_spawn_file_actions_destroy(pactions);
+  if(ret) {
+    errno = ret;
+    return -1;
   }
+  return pid;
+}
+
+/** Execute a sub-command (without any shell) and return a file
+    descriptor connected to its stdout and its pid. In case of error,
+    -1 is returned and errno is set appropriately. The error could
+    come from pipe2(2) or posix_spawnp(3), including the failure to
+    exec the command. If check_exec is false, the failure to exec is
+    not an error and an empty stream is returned (with a pid of -1).
+*/
+fd_pid open_sub_process(const char* const cmd[], bool check_exec,
+                        bool merge_stderr) {
+  // pipe connected to sub-command stdout. Both ends are closed on
+  // exec, the copy on stdout of the child is not.
+  int   sub_stdout[2] = { -1, -1 };
+  pid_t pid;
+
+  if(pipe2(sub_stdout, O_CLOEXEC) == -1) goto failed;
+  pid = spawn_command(cmd, sub_stdout[1], merge_stderr);
+  if(pid == -1 && check_exec) goto failed;
+  if(close(sub_stdout[1]) == -1) goto failed;
   return std::make_pair(sub_stdout[0], pid);
 
  failed:
   int save_errno = errno;
-  if(exec_worked[0] >= 0) close(exec_worked[0]);
-  if(exec_worked[1] >= 0) close(exec_worked[1]);
   if(sub_stdout[0] >= 0) close(sub_stdout[0]);
   if(sub_stdout[1] >= 0) close(sub_stdout[1]);
   errno = save_errno;
@@ -130,6 +108,8 @@ pipe_open::~pipe_open() {
 std::pair<int, pid_t> pipe_open::status(bool no_hang) {
   pid_t status = -1;
   errno = 0;
+  if(fd_pid::second == -1) // Command could not be exec'ed
+    return std::make_pair(0, 127 << 8);
   waitpid(fd_pid::second, &status, no_hang ? WNOHANG : 0);
   return std::make_pair(errno, status);
 }
@@ -5,7 +5,27 @@
 #include <string>
 #include <iostream>
 
+/** Start the command given in cmd (the array must be 0 terminated)
+    with posix_spawnp, which does not copy the address space of the
+    caller (vfork semantics). If stdout_fd >= 0, the standard output of
+    the command is redirected to it, and its standard error too if
+    merge_stderr is true. Return the pid of the command, or -1 with
+    errno set if it could not be started, including when the exec
+    failed.
+ */
+pid_t spawn_command(const char* const cmd[], int stdout_fd = -1,
+                    bool merge_stderr = false);
+
 typedef std::pair<int, pid_t> fd_pid;
+
+/** Start the command given in cmd and return a file descriptor
+    connected to its standard output and its pid. On error, the file
+    descriptor is -1 and errno is set. This is the low level part of
+    pipe_open: the caller must close the file descriptor and wait on
+    the pid.
+ */
+fd_pid open_sub_process(const char* const cmd[], bool check_exec = true,
+                        bool merge_stderr = false);
 class pipe_open : public fd_pid, public std::istream {
   typedef std::istream stream;
   typedef __gnu_cxx::stdio_filebuf<char> stdbuf;
@@ -1,10 +1,12 @@
 #include <string.h>
 #include <math.h>
 #include <iostream>
+#include <algorithm>
 
 #include <src/tty_writer.hpp>
 #include <src/print_info.hpp>
 #include <src/pvof.hpp>
+#include <src/tick_arena.hpp>
 
 
 std::string shorten_string(const std::string& s, unsigned int length) {
@@ -19,6 +21,22 @@ std::string shorten_string(const std::string& s, unsigned int length) {
   return res;
 }
 
+std::ostream& operator<<(std::ostream& os, const shortened& x) {
+  if(x.s.size() <= x.length) {
+    os << x.s;
+    for(size_t i = x.s.size(); i < x.length; ++i)
+      os.put(' ');
+  } else {
+    os << "..." << x.s.substr(x.s.size() - x.length + 3, x.length - 3);
+  }
+  return os;
+}
+
+static std::string trim(const std::string& s) {
+  const size_t start = s.find_first_not_of(' ');
+  return start == std::string::npos ? std::string() : s.substr(start, s.find_last_not_of(' ') - start + 1);
+}
+
 static const char large_prefix[] = { ' ', 'k', 'M', 'G', 'T', 'P', 'E', 'Z', 'Y' };
 static const char small_prefix[] = { ' ', 'm', 'u', 'n', 'p', 'f', 'a', 'z', 'y' };
 std::string numerical_field_to_str(double val) {
@@ -83,8 +101,15 @@ std::string format_eta(bool writable, off_t size, off_t offset, double speed) {
   return seconds_to_str(offset / -speed);
 }
 
-void print_file_list(const updater_list_type& updaters,
-                     const std::vector<file_list>& lists, const io_info_list& ios, tty_writer& writer) {
+// Throughput of a process and its displayed descendants
+struct subtree_info {
+  double read, write;
+  size_t descendants;
+};
+
+template<typename Session>
+static void print_process(const process_entry& process, int depth, const subtree_info& subtree,
+                          tty_writer& writer, Session& session, int window_width) {
   constexpr int header_width =
     6 /* offset */ + 1 /* slash */ + 6  /* size */ +
     1 /* column */ + 8 /* speed */ + 1  /* column */ +
@@ -99,54 +124,138 @@ void print_file_list(const updater_list_type& updaters,
     8 /* rspeed */ + 1 /* column */ + 8 /* ravg */ +
     1 /* pipe */ + 8 /* wspeed */ + 1 /* column */ +
     8 /* wavg */ + 2 /* spaces */;
+  constexpr int min_width = 3; // Room for "..."
+
+  const auto& io   = process.io;
+  const auto& list = process.files;
+  const int id_width = std::max(window_width - ioheader_width, min_width);
+  const int indent   = std::min(2 * depth, id_width - min_width);
+  std::pmr::string id(process.updater->strid(), tick_arena::instance().resource());
+  if(subtree.descendants > 0) {
+    id += " [+";
+    id += std::to_string(subtree.descendants);
+    id += numerical_field_to_str(subtree.read);
+    id += "/s|";
+    id += numerical_field_to_str(subtree.write);
+    id += "/s]";
+  }
+  { auto line = session.start_line();
+    line << writer.underline
+         << "CHAR " << writer.read << numerical_field_to_str(io.char_counter.read) << writer.normal
+         << '|' << writer.write << numerical_field_to_str(io.char_counter.write) << writer.normal
+         << ' ' << writer.read << numerical_field_to_str(io.char_speed.read) << "/s" << writer.normal
+         << ':' << writer.read << numerical_field_to_str(io.char_avg.read) << "/s" << writer.normal
+         << '|' << writer.write << numerical_field_to_str(io.char_speed.write) << "/s" << writer.normal
+         << ':' << writer.write << numerical_field_to_str(io.char_avg.write) << "/s" << writer.normal
+         << " IO " << writer.read << numerical_field_to_str(io.io_counter.read) << writer.normal
+         << '|' << writer.write << numerical_field_to_str(io.io_counter.write) << writer.normal
+         << ' ' << writer.read << numerical_field_to_str(io.io_speed.read) << "/s" << writer.normal
+         << ':' << writer.read << numerical_field_to_str(io.io_avg.read) << "/s" << writer.normal
+         << '|' << writer.write << numerical_field_to_str(io.io_speed.write) << "/s" << writer.normal
+         << ':' << writer.write << numerical_field_to_str(io.io_avg.write) << "/s" << writer.normal
+         << ' ' << shortened("", indent) << shortened(id, id_width - indent)
+         << writer.reset;
+  }
+
+  const int name_width = std::max(window_width - header_width, min_width);
+  for(auto it = list.begin(); it != list.end(); ++it) {
+    if(it->owner) continue; // Displayed by the process sharing it
+    auto line = session.start_line();
+    const char* color = it->writable ? writer.write : writer.read;
+    // Print offset
+    line << color << numerical_field_to_str(it->offset) << writer.normal << '/';
+    // Print file size
+    if(it->writable) // Don't display size on writable files
+      line << "   -  ";
+    else
+      line << color << numerical_field_to_str(it->size) << writer.normal;
+    // Print speed
+    line << ':' << color << numerical_field_to_str(it->speed) << "/s" << writer.normal << ':';
+    // Display ETA
+    line << format_eta(it->writable, it->size, it->offset, it->speed)
+         << ':'
+         << format_eta(it->writable, it->size, it->offset, it->average);
 
+    line << ' ';
+    if(!it->updated)
+      line << writer.reverse;
+    std::pmr::string suffix(tick_arena::instance().resource());
+    if(it->updated && it->stamp == mono_time()) { // Not sampled yet (--fd-budget)
+      suffix += " (not sampled)";
+    } else if(it->updated && it->stamp < io.stamp) { // Not sampled at this update
+      suffix += " (";
+      suffix += trim(seconds_to_str(to_seconds(io.stamp - it->stamp)));
+      suffix += " old)";
+    }
+    if(it->sharers) { // Same description in other processes
+      suffix += " (shared with";
+      for(const pid_t pid : *it->sharers) {
+        suffix += ' ';
+        suffix += std::to_string(pid);
+      }
+      suffix += ')';
+    }
+    if(suffix.empty()) {
+      line << shortened(it->name.str(), name_width);
+    } else {
+      std::pmr::string name(it->name.str(), tick_arena::instance().resource());
+      name += suffix;
+      line << shortened(name, name_width);
+    }
+    if(!it->updated)
+      line << writer.reverse;
+  }
+
+  // Closed files archived (--keep-closed): total bytes and their
+  // average rate, the bytes moved over the time they were sampled
+  const auto& archive = list.archive;
+  if(archive.files > 0) {
+    auto line = session.start_line();
+    line << numerical_field_to_str(archive.bytes) << "/   -  :"
+         << numerical_field_to_str(archive.rate()) << "/s:   -  :   -   "
+         << writer.reverse
+         << shortened("(" + std::to_string(archive.files) + " closed files)", name_width)
+         << writer.reverse;
+  }
+}
+
+void print_file_list(const process_table& processes, const process_tree& tree, tty_writer& writer,
+                     const std::string& status) {
   auto        session      = writer.start_session();
   const int   window_width = writer.get_window_width();
 
-  for(size_t i = 0; i < lists.size(); ++i) {
-    const auto& io = ios[i];
-    const auto& list = lists[i];
-    { auto line = session.start_line();
-      line << writer.underline
-           << "CHAR " << writer.read << numerical_field_to_str(io.char_counter.read) << writer.normal
-           << '|' << writer.write << numerical_field_to_str(io.char_counter.write) << writer.normal
-           << ' ' << writer.read << numerical_field_to_str(io.char_speed.read) << "/s" << writer.normal
-           << ':' << writer.read << numerical_field_to_str(io.char_avg.read) << "/s" << writer.normal
-           << '|' << writer.write << numerical_field_to_str(io.char_speed.write) << "/s" << writer.normal
-           << ':' << writer.write << numerical_field_to_str(io.char_avg.write) << "/s" << writer.normal
-           << " IO " << writer.read << numerical_field_to_str(io.io_counter.read) << writer.normal
-           << '|' << writer.write << numerical_field_to_str(io.io_counter.write) << writer.normal
-           << ' ' << writer.read << numerical_field_to_str(io.io_speed.read) << "/s" << writer.normal
-           << ':' << writer.read << numerical_field_to_str(io.io_avg.read) << "/s" << writer.normal
-           << '|' << writer.write << numerical_field_to_str(io.io_speed.write) << "/s" << writer.normal
-           << ':' << writer.write << numerical_field_to_str(io.io_avg.write) << "/s" << writer.normal
-           << ' ' << shorten_string(updaters[i]->strid(), window_width - ioheader_width)
-           << writer.reset;
+  // Sum the throughput of each process into all its ancestors in the
+  // tree, which precede it in depth first order.
+  std::pmr::memory_resource* const       arena = tick_arena::instance().resource();
+  process_tree::order_type               order(arena);
+  tree.order(order);
+  std::pmr::vector<const process_entry*> entries(order.size(), arena);
+  std::pmr::vector<subtree_info>         subtrees(order.size(), arena);
+  std::pmr::vector<size_t>               ancestors(arena);
+  for(size_t i = 0; i < order.size(); ++i) {
+    while(!ancestors.empty() && order[ancestors.back()].second >= order[i].second)
+      ancestors.pop_back();
+    ancestors.push_back(i);
+    entries[i] = processes.find(order[i].first);
+    if(!entries[i]) continue; // E.g. a zombie
+    for(auto a : ancestors) {
+      subtrees[a].read  += entries[i]->io.char_speed.read;
+      subtrees[a].write += entries[i]->io.char_speed.write;
+      subtrees[a].descendants += a != i;
     }
+  }
 
-    for(auto it = list.begin(); it != list.end(); ++it) {
-      auto line = session.start_line();
-      const char* color = it->writable ? writer.write : writer.read;
-      // Print offset
-      line << color << numerical_field_to_str(it->offset) << writer.normal << '/';
-      // Print file size
-      if(it->writable) // Don't display size on writable files
-        line << "   -  ";
-      else
-        line << color << numerical_field_to_str(it->size) << writer.normal;
-      // Print speed
-      line << ':' << color << numerical_field_to_str(it->speed) << "/s" << writer.normal << ':';
-      // Display ETA
-      line << format_eta(it->writable, it->size, it->offset, it->speed)
-           << ':'
-           << format_eta(it->writable, it->size, it->offset, it->average);
-
-      line << ' ';
-      if(!it->updated)
-        line << writer.reverse;
-      line << shorten_string(it->name, window_width - header_width);
-      if(!it->updated)
-        line << writer.reverse;
-    }
+  for(size_t i = 0; i < order.size(); ++i)
+    if(entries[i])
+      print_process(*entries[i], order[i].second, subtrees[i], writer, session, window_width);
+
+  // Processes which exited and left the tree, but are still displayed
+  for(const auto& process : processes)
+    if(!tree.contains(process.updater->pid()))
+      print_process(process, 0, subtree_info{ 0, 0, 0 }, writer, session, window_width);
+
+  if(!status.empty()) {
+    auto line = session.start_line();
+    line << shortened(status, std::max(window_width, 3));
   }
 }
@@ -2,14 +2,30 @@
 #define __PRINT_INFO_HPP__
 
 #include <ostream>
+#include <string_view>
 #include <src/lsof.hpp>
 #include <src/tty_writer.hpp>
 #include <src/file_info.hpp>
+#include <src/process_table.hpp>
+#include <src/process_tree.hpp>
 
 void prepare_display();
-void print_file_list(const updater_list_type& updaters, const std::vector<file_list>& lists, const io_info_list& ios, tty_writer& writer);
+// Print the processes in tree order, indented by depth. A process with
+// children also shows the throughput of its whole subtree. status, if
+// not empty, is printed on a last line.
+void print_file_list(const process_table& processes, const process_tree& tree, tty_writer& writer,
+                     const std::string& status = std::string());
 
 std::string numerical_field_to_str(double val);
 std::string seconds_to_str(double seconds);
 std::string shorten_string(const std::string& s, unsigned int length);
+
+// Write s on a stream shortened or padded to length, as
+// shorten_string, without building the string
+struct shortened {
+  std::string_view s;
+  unsigned int     length;
+  shortened(std::string_view str, unsigned int len) : s(str), length(len) { }
+};
+std::ostream& operator<<(std::ostream& os, const shortened& x);
 #endif
@@ -1,138 +1,528 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <fnmatch.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#include <linux/kcmp.h>
 #include <cstring>
+#include <cerrno>
 #include <iostream>
 #include <fstream>
 #include <memory>
-#include <filesystem>
+#include <algorithm>
+#include <thread>
+#include <charconv>
+#include <cinttypes>
+#include <cstdio>
 
 #include <src/proc.hpp>
+#include <src/file_filter.hpp>
+#include <src/tick_arena.hpp>
+#include <src/dir_entries.hpp>
 
-struct dirfd {
-  DIR* d_;
-  dirfd(const char* path) : d_(opendir(path)) { }
-  ~dirfd() {
-    if(d_)
-      closedir(d_);
-  }
-  operator DIR*() { return d_; }
-};
-
-std::string full_path(const std::string& path) {
-  size_t size = 1024;
-  std::unique_ptr<char[]> buf(new char[size]);
-  ssize_t len = readlink(path.c_str(), buf.get(), size - 1);
-  if(len == -1) return "";
+// Read a file relative to dir_fd into buf, as a nul terminated
+// string. Truncated if larger than buf.
+static ssize_t read_at(int dir_fd, const char* path, char* buf, size_t size) {
+  int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) return -1;
+  size_t  len = 0;
+  ssize_t res;
+  while(len < size - 1 && (res = read(fd, buf + len, size - 1 - len)) > 0)
+    len += res;
+  close(fd);
   buf[len] = '\0';
-  return std::string(buf.get());
-}
-
-bool proc_file_info::update_file_info(file_list& list, const timespec& stamp) {
-  for(auto& it : list)
-    it.updated = false;
-
-  struct dirfd fdinfo(fdinfo_.c_str());
-  if(!fdinfo) return false;
-
-  struct dirent* ent;
-  struct stat    stat_buf;
-  std::string    p;
-  while((ent = readdir(fdinfo))) {
-    if(!strcmp(".", ent->d_name) || !strcmp("..", ent->d_name)) continue;
-    p = fd_ + '/' + ent->d_name;
-    if(stat(p.c_str(), &stat_buf) == -1) continue; // failed to stat -> skip
-    if(!force_ && !S_ISREG(stat_buf.st_mode)) continue; // not regular file -> skip
-
-    int fd = std::atoi(ent->d_name);
-    auto cfile = list.find(fd, stat_buf.st_ino);
-    bool new_file = cfile == list.end();
-    if(new_file) {// file does not exists. Add it
-      file_info fi;
-      fi.fd          = fd;
-      fi.inode       = stat_buf.st_ino;
-      fi.name        = full_path(p);
-      fi.offset      = 0;
-      fi.ooffset     = 0;
-      fi.size        = stat_buf.st_size;
-      fi.writable    = false;
-      fi.speed       = 0;
-      fi.average     = 0;
-      fi.updated     = true;
-      fi.stamp       = stamp;
-      fi.start       = stamp;
-      list.push_back(fi);
-      cfile = list.back_iterator();
+  return len;
+}
+
+// Size of the fd table of the process, -1 if unknown
+static long read_fdsize(const std::string& status) {
+  char buf[4096];
+  if(read_at(AT_FDCWD, status.c_str(), buf, sizeof(buf)) <= 0) return -1;
+  const char* line = strstr(buf, "\nFDSize:");
+  return line ? std::atol(line + 8) : -1;
+}
+
+bool proc_file_info::need_enumerate() {
+  const long fdsize = read_fdsize(status_);
+  const bool res    = ticks_ >= list_every_ || fdsize != fdsize_;
+  recheck_          = recheck_ || (fdsize_ != -1 && fdsize != fdsize_);
+  fdsize_           = fdsize;
+  return res;
+}
+
+proc_file_info::~proc_file_info() {
+  for(int wd : held_)
+    watches_->release(wd);
+  if(fdinfo_fd_ != -1)
+    close(fdinfo_fd_);
+  if(fd_fd_ != -1)
+    close(fd_fd_);
+}
+
+// Inode in a link target like "socket:[1234]", 0 if none
+static ino_t link_inode(const char* target) {
+  const char* open = strchr(target, '[');
+  return open ? strtoull(open + 1, nullptr, 10) : 0;
+}
+
+bool proc_file_info::enumerate(file_list& list) {
+  if(!start_listing()) return false;
+  if(!for_each_entry(fd_fd_, [&](const char* name, unsigned char) { list_fd(list, name); })) {
+    listing_ = false; // E.g. the process is gone
+    return false;
+  }
+  end_listing(list);
+  return true;
+}
+
+bool proc_file_info::start_listing() {
+  // Read from the start the directory held open
+  if(fd_fd_ == -1 || lseek(fd_fd_, 0, SEEK_SET) == -1) return false;
+  ticks_   = 0;
+  listing_ = true;
+  ++listings_;
+  return true;
+}
+
+bool proc_file_info::resume_listing(file_list& list, size_t nb) {
+  // An entry takes 32 bytes for a name of up to 11 characters
+  alignas(linux_dirent64) char buf[64 * 1024];
+  const long len = read_entries(fd_fd_, buf, std::min(sizeof(buf), 32 * std::max(nb, (size_t)1)),
+                                [&](const char* name, unsigned char) { list_fd(list, name); });
+  if(len == -1) {
+    listing_ = false;
+    return false;
+  }
+  if(len == 0)
+    end_listing(list);
+  return true;
+}
+
+void proc_file_info::end_listing(file_list& list) {
+  listing_      = false;
+  recheck_      = false;
+  stats_.listed = true;
+  // The descriptors listed have their verdict stamped with this listing
+  for(auto& file : list) {
+    if(!file.updated) continue;
+    const auto cls = classes_.find(file.fd);
+    if(cls == classes_.end() || cls->second.listing != listings_ || cls->second.ino != file.inode) {
+      file.updated = false;
+      ++stats_.closed;
     }
+  }
 
-    off_t save_offset = cfile->offset;
-    p = fdinfo_ + '/' + ent->d_name;
-    std::ifstream fdinfo_fd(p);
-    if(!fdinfo_fd.good()) continue;
-    update_file_info(*cfile, stamp, fdinfo_fd, new_file);
-    fdinfo_fd.close();
+  // Forget the descriptors closed
+  for(auto it = classes_.begin(); it != classes_.end(); ) {
+    if(it->second.listing != listings_)
+      it = classes_.erase(it);
+    else
+      ++it;
+  }
+}
 
-    if(stamp != cfile->start) {
-      cfile->speed   = (cfile->offset - save_offset) / timespec_double(stamp - cfile->stamp);
-      cfile->average = (cfile->offset - cfile->ooffset) / timespec_double(stamp - cfile->start);
-    } else {
-      cfile->ooffset = cfile->offset;
+void proc_file_info::list_fd(file_list& list, const char* name) {
+  struct stat stat_buf;
+  char        target[PATH_MAX];
+  const ssize_t len = readlinkat(fd_fd_, name, target, sizeof(target) - 1);
+  if(len == -1) return; // Closed since
+  target[len] = '\0';
+
+  // Classify from the link target: "socket:[ino]", "pipe:[ino]" and
+  // "anon_inode:..." are not regular files. A path is stat'ed once,
+  // and the filter applied then. A rejected path is stat'ed again when
+  // the fd table changed, in case its file was replaced: its inode
+  // number alone may have been reused.
+  const int   fd      = std::atoi(name);
+  const bool  is_path = target[0] == '/';
+  const ino_t ino     = is_path ? 0 : link_inode(target);
+  auto        cls     = classes_.find(fd);
+  const bool  cached  = cls != classes_.end()
+    && (is_path ? cls->second.target == target && (cls->second.keep || !recheck_) : cls->second.ino == ino);
+  if(cached) {
+    cls->second.listing = listings_;
+    if(!cls->second.keep) return;
+  } else {
+    if(!force_ && !is_path) {
+      classes_[fd] = { ino, false, interned_path(), listings_ };
+      return;
     }
-    cfile->stamp   = stamp;
-    cfile->updated = true;
+    if(fstatat(fd_fd_, name, &stat_buf, 0) == -1) return; // failed to stat -> skip
+    const bool keep = (force_ || S_ISREG(stat_buf.st_mode))
+      && (!filter_ || filter_->accept(target, stat_buf.st_dev, stat_buf.st_size));
+    cls = classes_.insert_or_assign(fd, fd_class{ stat_buf.st_ino, keep, is_path ? interned_path(target) : interned_path(), listings_ }).first;
+    if(!keep) return; // not regular file or filtered -> skip
   }
+
+  const ino_t inode = cached ? cls->second.ino : stat_buf.st_ino;
+  auto cfile = list.find(fd, inode);
+  if(cfile == list.end()) {// file does not exists. Add it
+    if(cached && fstatat(fd_fd_, name, &stat_buf, 0) == -1) return;
+    char p[PATH_MAX];
+    snprintf(p, sizeof(p), "%s/%s", fd_.c_str(), name);
+    file_info fi;
+    fi.fd          = fd;
+    fi.inode       = inode;
+    fi.name        = cls->second.target.empty() ? interned_path(target) : cls->second.target;
+    fi.offset      = 0;
+    fi.ooffset     = 0;
+    fi.size        = stat_buf.st_size;
+    fi.dev         = stat_buf.st_dev;
+    fi.writable    = false;
+    fi.speed       = 0;
+    fi.average     = 0;
+    fi.stamp       = mono_time(); // Not sampled yet
+    fi.start       = mono_time();
+    if(watches_ && (fi.wd = watches_->add(p)) != -1)
+      held_.insert(fi.wd);
+    list.push_back(fi);
+    cfile = list.back_iterator();
+    ++stats_.opened;
+  }
+  cfile->updated = true;
+}
+
+bool proc_file_info::sample(file_info& info) {
+  // Read with openat(2) from the fdinfo directory, without building a
+  // path and a stream for every file.
+  char name[16];
+  char buf[1024];
+  *std::to_chars(name, name + sizeof(name) - 1, info.fd).ptr = '\0';
+  const bool  is_new      = info.start == mono_time();
+  const off_t save_offset = info.offset;
+  if(read_at(fdinfo_fd_, name, buf, sizeof(buf)) <= 0 || !parse_fdinfo(info, buf, is_new)) {
+    info.updated = false;
+    classes_.erase(info.fd); // Maybe reused for a file with the same path
+    return false;
+  }
+
+  update_rates(info, save_offset, is_new);
   return true;
 }
 
-bool proc_file_info::update_file_info(file_info& info, const timespec& stamp, std::istream& in, const bool is_new) {
-  std::string label;
-
-  try {
-    while(in.good()) {
-      in >> label;
-      if(in.eof()) break;
-      if(label == "pos:") {
-        in >> std::dec >> info.offset;
-      } else if(label == "flags:" && is_new) {
-        int flags;
-        in >> std::oct >> flags;
-        info.writable = (flags & O_WRONLY) || (flags & O_RDWR);
-      } else {
-        int ignore;
-        in >> ignore;
+void proc_file_info::update_rates(file_info& info, off_t previous, bool is_new) {
+  // Rates are computed from the time each offset was actually read,
+  // which may be well after the start of the update in a large scan.
+  const mono_time sample = mono_now();
+  if(!is_new) {
+    info.speed   = (info.offset - previous) / to_seconds(sample - info.stamp);
+    info.average = (info.offset - info.ooffset) / to_seconds(sample - info.start);
+  } else {
+    info.ooffset = info.offset;
+    info.start   = sample;
+  }
+  info.stamp = sample;
+}
+
+void proc_file_info::skip(file_info& info, const mono_time& now) {
+  info.speed   = 0;
+  info.average = (info.offset - info.ooffset) / to_seconds(now - info.start);
+  info.stamp   = now;
+  ++stats_.skipped;
+}
+
+void proc_file_info::release_watches(file_list& list) {
+  for(auto& file : list) {
+    if(file.updated || file.wd == -1) continue;
+    watches_->release(file.wd);
+    held_.erase(held_.find(file.wd));
+    file.wd = -1;
+  }
+}
+
+bool proc_file_info::update_file_info(file_list& list, const mono_time& stamp) {
+  stats_ = update_stats();
+  ++ticks_;
+  const uint64_t since = last_poll_;
+  if(watches_)
+    last_poll_ = watches_->poll();
+  const mono_time polled = mono_now();
+  // Sampled before and not active then, and no inotify event since.
+  // Files without a watch (wd == -1) are always read.
+  auto unchanged = [&](const file_info& file) {
+    return file.wd != -1 && file.start != mono_time() && file.speed == 0
+      && !watches_->changed(file.wd, since) && same_description(file);
+  };
+
+  bool listed = false;
+  if(budget_ == 0 || list.size() <= budget_) {
+    listed = need_enumerate();
+    if(listed && !enumerate(list)) return false;
+    cursor_ = 0;
+    active_.clear();
+  }
+  // Without budget, sample all the known files
+  if(budget_ == 0 || list.size() <= budget_) {
+    bool closed = false;
+    for(auto& file : list) {
+      if(!file.updated || file.owner) continue;
+      if(unchanged(file)) {
+        skip(file, polled);
+      } else if(!sample(file)) {
+        closed = true;
+        ++stats_.closed;
       }
     }
-  } catch(std::ios_base::failure& e) {
-    // Do nothing
+    // A descriptor was closed or reused: look for the new files now
+    if(closed && !listed) {
+      if(!enumerate(list)) return false;
+      for(auto& file : list)
+        if(file.updated && !file.owner && file.stamp < stamp)
+          sample(file);
+    }
+    if(watches_)
+      release_watches(list);
+    return true;
   }
+
+  // Start a listing at the start of a round, if due, and continue it
+  // by budget entries. The files closed in the meantime are found when
+  // sampled.
+  if(!listing_ && cursor_ == 0 && need_enumerate() && !start_listing()) return false;
+  if(listing_ && !resume_listing(list, budget_)) return false;
+  const size_t nb_files = list.size();
+  size_t       nb       = 0;
+  auto sampled = [&](const file_info& file) { return !(file.stamp < stamp); };
+  // With a non zero speed at their last sample, or sampled only once so
+  // far (speed unknown)
+  auto active = [](const file_info& file) {
+    return file.updated && (file.speed != 0 || file.start == file.stamp);
+  };
+
+  // Active files, from where the previous update stopped. Dropped when
+  // closed or idle.
+  auto it = active_.find(active_next_);
+  for(size_t i = active_.size(); i > 0 && !active_.empty() && nb < budget_ / 2; --i) {
+    if(it == active_.end()) it = active_.begin();
+    const auto file = list.find(it->first, it->second);
+    if(file == list.end() || !file->updated || file->owner) {
+      it = active_.erase(it);
+      continue;
+    }
+    stats_.closed += !sample(*file);
+    ++nb;
+    it = active(*file) ? std::next(it) : active_.erase(it);
+  }
+  if(it == active_.end()) it = active_.begin();
+  active_next_ = it == active_.end() ? -1 : it->first;
+
+  // Round robin over all the files
+  for( ; cursor_ < nb_files && nb < budget_; ++cursor_) {
+    file_info& file = list.list[cursor_];
+    if(!file.updated || file.owner || sampled(file)) continue;
+    if(unchanged(file)) { // Free, does not count in the budget
+      skip(file, polled);
+      continue;
+    }
+    stats_.closed += !sample(file);
+    ++nb;
+    if(active(file))
+      active_.insert_or_assign(file.fd, file.inode);
+  }
+  if(cursor_ >= nb_files)
+    cursor_ = 0;
+  if(watches_)
+    release_watches(list);
   return true;
 }
 
-bool proc_file_info::update_io_info(io_info& info, const timespec& stamp) {
-  std::string label;
+bool proc_file_info::parse_fdinfo(file_info& info, const char* buf, const bool is_new) {
+  // Lines "label:\tvalue"
+  for(const char* line = buf; *line; ) {
+    const char* value = strchr(line, ':');
+    if(!value) break;
+    ++value;
+    if(!strncmp(line, "pos:", 4)) {
+      info.offset = strtoll(value, nullptr, 10);
+    } else if(!strncmp(line, "ino:", 4)) {
+      if((ino_t)strtoull(value, nullptr, 10) != info.inode) return false; // Descriptor reused
+    } else if(!strncmp(line, "flags:", 6) && is_new) {
+      const long flags = strtol(value, nullptr, 8);
+      info.writable = (flags & O_WRONLY) || (flags & O_RDWR);
+    }
+    const char* end = strchr(value, '\n');
+    if(!end) break;
+    line = end + 1;
+  }
+  return true;
+}
+
+// Duplicates open in all the getfd_file_info, and number of
+// getfd_file_info
+static size_t nb_duplicates = 0;
+static size_t nb_getfd      = 0;
+// Duplicates allowed when the system ran out of descriptors
+static size_t getfd_full    = SIZE_MAX;
+
+// Limit on open files, the soft limit raised to the hard limit
+static size_t raise_fd_limit() {
+  rlimit lim;
+  if(getrlimit(RLIMIT_NOFILE, &lim) == -1) return 0;
+  if(lim.rlim_cur < lim.rlim_max) {
+    const rlim_t cur = lim.rlim_cur;
+    lim.rlim_cur     = lim.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE, &lim) == -1)
+      lim.rlim_cur = cur;
+  }
+  return lim.rlim_cur == RLIM_INFINITY ? (size_t)1 << 20 : std::min((size_t)lim.rlim_cur, (size_t)1 << 20);
+}
+
+// Whether another duplicate fits, leaving room for the other
+// descriptors: the fdinfo directory and pidfd of each process, the
+// files of /proc being read, the display
+static bool room_for_duplicate() {
+  static const size_t limit = raise_fd_limit();
+  const size_t reserve = std::max(limit / 4, 256 + 4 * nb_getfd);
+  return nb_duplicates < getfd_full && nb_duplicates + reserve < limit;
+}
+
+getfd_file_info::getfd_file_info(pid_t pid, bool force, bool numeric, size_t budget, unsigned list_every,
+                                 std::shared_ptr<inotify_watches> watches,
+                                 std::shared_ptr<const file_filter> filter)
+  : proc_file_info(pid, force, numeric, budget, list_every, std::move(watches), std::move(filter))
+  , own_(pid == getpid())
+  , self_(getpid())
+#if defined(SYS_pidfd_getfd) && defined(SYS_kcmp)
+  , getfd_(own_ || pidfd().good())
+#else
+  , getfd_(false)
+#endif
+{
+  ++nb_getfd;
+}
+
+getfd_file_info::~getfd_file_info() {
+  for(const auto& it : dups_)
+    release(it.second);
+  --nb_getfd;
+}
+
+void getfd_file_info::release(int dup) {
+  if(dup == -1 || own_) return;
+  close(dup);
+  --nb_duplicates;
+  getfd_full = SIZE_MAX; // Maybe room again
+}
+
+size_t getfd_file_info::duplicates() const {
+  return std::count_if(dups_.begin(), dups_.end(), [](const std::pair<const int, int>& d) { return d.second != -1; });
+}
+
+int getfd_file_info::duplicate(const file_info& info) {
+  if(!getfd_) return -1;
+  auto it = dups_.find(info.fd);
+  if(it != dups_.end()) return it->second;
+
+  if(!own_ && !room_for_duplicate()) return -1;
+
+#if defined(SYS_pidfd_getfd) && defined(SYS_kcmp)
+  const int dup = own_ ? info.fd : syscall(SYS_pidfd_getfd, pidfd().fd(), info.fd, 0);
+#else
+  const int dup = -1;
+  errno         = ENOSYS;
+#endif
+  if(dup == -1) {
+    // Not allowed for this process. Out of descriptors: no more
+    // duplicates until one is closed. Otherwise (closed since the
+    // listing), try again at the next sample.
+    if(errno == EPERM || errno == ENOSYS)
+      getfd_ = false;
+    else if(errno == EMFILE || errno == ENFILE)
+      getfd_full = nb_duplicates;
+    return -1;
+  }
+  nb_duplicates += !own_;
+  struct stat stat_buf;
+  if(fstat(dup, &stat_buf) == -1 || stat_buf.st_ino != info.inode) { // Reused since the listing
+    release(dup);
+    return -1;
+  }
+  if(!S_ISREG(stat_buf.st_mode)) { // Forced, no offset to lseek
+    release(dup);
+    dups_.emplace(info.fd, -1);
+    return -1;
+  }
+  dups_.emplace(info.fd, dup);
+  return dup;
+}
+
+void getfd_file_info::end_listing(file_list& list) {
+  proc_file_info::end_listing(list);
+  // Close the duplicates of the descriptors closed
+  for(auto it = dups_.begin(); it != dups_.end(); ) {
+    const auto file = list.fds.find(it->first);
+    if(file == list.fds.end() || !list.list[file->second].updated) {
+      release(it->second);
+      it = dups_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool getfd_file_info::same_description(const file_info& info) {
+  if(own_) return true;
+  const auto it = dups_.find(info.fd);
+  if(it == dups_.end() || it->second == -1) return true;
+#ifdef SYS_kcmp
+  return syscall(SYS_kcmp, self_, pid(), KCMP_FILE, it->second, info.fd) == 0;
+#else
+  return true;
+#endif
+}
+
+bool getfd_file_info::sample(file_info& info) {
+  const int dup = duplicate(info);
+  if(dup == -1) return proc_file_info::sample(info);
+
+  const bool  is_new      = info.start == mono_time();
+  const off_t save_offset = info.offset;
+  struct stat stat_buf;
+  off_t       offset;
+#ifdef SYS_kcmp
+  const bool same = own_ || syscall(SYS_kcmp, self_, pid(), KCMP_FILE, dup, info.fd) == 0;
+#else
+  const bool same = own_;
+#endif
+  if(!same || (offset = lseek(dup, 0, SEEK_CUR)) == -1 || fstat(dup, &stat_buf) == -1
+     || stat_buf.st_ino != info.inode) {
+    // Closed or reused: drop the duplicate, fdinfo tells which
+    release(dup);
+    dups_.erase(info.fd);
+    return proc_file_info::sample(info);
+  }
+  if(is_new) {
+    const int flags = fcntl(dup, F_GETFL);
+    info.writable   = flags != -1 && (flags & O_ACCMODE) != O_RDONLY;
+  }
+  info.offset = offset;
+  info.size   = stat_buf.st_size;
+  update_rates(info, save_offset, is_new);
+  return true;
+}
+
+bool proc_file_info::update_io_info(io_info& info, const mono_time& stamp) {
   uint64_t rchar, wchar, rsys, wsys, rio, wio;
+  char     buf[512];
 
-  try {
-    std::ifstream is(ioinfo_);
-    is >> label >> rchar
-       >> label >> wchar
-       >> label >> rsys
-       >> label >> wsys
-       >> label >> rio
-       >> label >> wio;
-    if(!is.good())
-      throw std::ios_base::failure("Couldn't read information");
-  } catch(std::ios_base::failure& e) {
+  // Lines "label: value", in order rchar, wchar, syscr, syscw,
+  // read_bytes and write_bytes
+  if(read_at(AT_FDCWD, ioinfo_.c_str(), buf, sizeof(buf)) <= 0
+     || sscanf(buf, "%*s %" SCNu64 " %*s %" SCNu64 " %*s %" SCNu64 " %*s %" SCNu64 " %*s %" SCNu64 " %*s %" SCNu64,
+               &rchar, &wchar, &rsys, &wsys, &rio, &wio) != 6) {
     ++info.dead_count;
     return false;
   }
+  const mono_time sample = mono_now(); // Time the counters were read
 
-  const bool empty = (info.start.tv_sec == 0);
+  const bool empty = (info.start == mono_time());
   if(!empty) {
-    const double speed_delta = timespec_double(stamp - info.stamp);
-    const double avg_delta   = timespec_double(stamp - info.start);
+    const double speed_delta = to_seconds(sample - info.stamp);
+    const double avg_delta   = to_seconds(sample - info.start);
     info.char_speed.read     = (rchar - info.char_counter.read) / speed_delta;
     info.char_avg.read       = (rchar - info.ochar_counter.read) / avg_delta;
     info.char_speed.write    = (wchar - info.char_counter.write) / speed_delta;
@@ -153,7 +543,7 @@ bool proc_file_info::update_io_info(io_info& info, const timespec& stamp) {
   info.sys_counter.write  = wsys;
   info.io_counter.read    = rio;
   info.io_counter.write   = wio;
-  info.stamp              = stamp;
+  info.stamp              = sample;
 
   if(empty) {
     info.ochar_counter.read  = rchar;
@@ -162,28 +552,186 @@ bool proc_file_info::update_io_info(io_info& info, const timespec& stamp) {
     info.osys_counter.write  = wsys;
     info.oio_counter.read    = rio;
     info.oio_counter.write   = wio;
-    info.start               = stamp;
+    info.start               = sample;
+  }
+  return true;
+}
+
+cmd_matcher::cmd_matcher(const std::vector<const char*>& patterns, mode_type mode, bool full)
+  : patterns_(patterns)
+  , mode_(mode)
+  , full_(full)
+{
+  if(mode_ != REGEX) return;
+  regexes_.reserve(patterns_.size());
+  for(const char* pattern : patterns_) {
+    regexes_.emplace_back();
+    const int res = regcomp(&regexes_.back(), pattern, REG_EXTENDED | REG_NOSUB);
+    if(res != 0) {
+      char buf[256];
+      regerror(res, &regexes_.back(), buf, sizeof(buf));
+      error_ = std::string("Invalid regular expression '") + pattern + "': " + buf;
+      regexes_.pop_back();
+      break;
+    }
+  }
+}
+
+cmd_matcher::~cmd_matcher() {
+  for(auto& re : regexes_)
+    regfree(&re);
+}
+
+bool cmd_matcher::match(const char* name) const {
+  switch(mode_) {
+  case EXACT:
+    return std::any_of(patterns_.begin(), patterns_.end(), [&](const char* s) { return !strcmp(name, s); });
+  case GLOB:
+    return std::any_of(patterns_.begin(), patterns_.end(), [&](const char* s) { return fnmatch(s, name, 0) == 0; });
+  case REGEX:
+    return std::any_of(regexes_.begin(), regexes_.end(), [&](const regex_t& re) { return regexec(&re, name, 0, nullptr, 0) == 0; });
+  }
+  return false;
+}
+
+bool match_cmd(const cmd_matcher& matcher, int proc_fd, pid_t pid) {
+  char    path[32];
+  char    buf[4096];
+  snprintf(path, sizeof(path), "%d/cmdline", (int)pid);
+  ssize_t len = read_at(proc_fd, path, buf, sizeof(buf));
+  if(len == -1) return false; // Process is gone
+  if(len == 0) { // No command line, use comm
+    snprintf(path, sizeof(path), "%d/comm", (int)pid);
+    len = read_at(proc_fd, path, buf, sizeof(buf));
+    if(len <= 0) return false;
+    if(buf[len - 1] == '\n') buf[--len] = '\0';
+    return matcher.match(buf);
   }
+
+  if(matcher.full()) { // Arguments separated by spaces
+    while(len > 0 && buf[len - 1] == '\0') --len;
+    std::replace(buf, buf + len, '\0', ' ');
+    buf[len] = '\0';
+    return matcher.match(buf);
+  }
+  const char* slash = strrchr(buf, '/'); // buf is argv[0]
+  return matcher.match(slash ? slash + 1 : buf);
+}
+
+// List the pids in /proc
+static void list_pids(int proc_fd, std::vector<pid_t>& pids) {
+  for_each_entry(proc_fd, [&](const char* name, unsigned char type) {
+      if(type != DT_DIR && type != DT_UNKNOWN) return;
+      char*       endptr;
+      const pid_t pid = strtol(name, &endptr, 10);
+      if(pid > 0 && *endptr == '\0') // Not a valid integer otherwise
+        pids.push_back(pid);
+    });
+}
+
+void find_cmds(const cmd_matcher& matcher, std::vector<pid_t>& pids, unsigned threads) {
+  const int proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(proc_fd == -1) return;
+  std::vector<pid_t> all;
+  list_pids(proc_fd, all);
+
+  // Each thread checks a contiguous range of pids: concatenating the
+  // results keeps the order of /proc.
+  threads = std::max(1u, std::min(threads, (unsigned)(all.size() / 64 + 1)));
+  std::vector<std::vector<pid_t>> found(threads);
+  auto worker = [&](unsigned t) {
+    const size_t start = all.size() * t / threads;
+    const size_t end   = all.size() * (t + 1) / threads;
+    for(size_t i = start; i < end; ++i)
+      if(match_cmd(matcher, proc_fd, all[i]))
+        found[t].push_back(all[i]);
+  };
+  std::vector<std::thread> workers;
+  for(unsigned t = 1; t < threads; ++t)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for(auto& w : workers)
+    w.join();
+  close(proc_fd);
+
+  for(const auto& f : found)
+    pids.insert(pids.end(), f.begin(), f.end());
+}
+
+bool cmd_watcher::read_identity(int proc_fd, pid_t pid, identity& id) {
+  char path[32];
+  char buf[1024];
+  snprintf(path, sizeof(path), "%d/stat", (int)pid);
+  if(read_at(proc_fd, path, buf, sizeof(buf)) <= 0) return false; // Process is gone
+  // "pid (comm) state ...", the comm may contain spaces and
+  // parentheses. The start time is the 20th field after the comm.
+  const char* open  = strchr(buf, '(');
+  const char* close = strrchr(buf, ')');
+  if(!open || !close || close < open) return false;
+  const size_t len = std::min((size_t)(close - open - 1), sizeof(id.comm) - 1);
+  memcpy(id.comm, open + 1, len);
+  id.comm[len] = '\0';
+  const char* field = close + 1;
+  for(int i = 0; i < 19 && field; ++i)
+    field = strchr(field + 1, ' ');
+  id.start = field ? strtoull(field + 1, nullptr, 10) : 0;
   return true;
 }
 
-void find_cmds(const std::vector<const char*>& cmds, std::vector<pid_t>& pids) {
-  std::string cmdline;
-  for(auto const& entry : std::filesystem::directory_iterator{"/proc"}) {
-    if(!entry.is_directory()) continue;
-    char* endptr = nullptr;
-    auto path = entry.path();
-    const auto dirname = path.filename();
-    const pid_t pid = strtol(dirname.c_str(), &endptr, 10);
-    if(pid <= 0 || (endptr != dirname.c_str() + strlen(dirname.c_str()))) continue; // Not a valid integer
-    path /= "cmdline";
-    std::ifstream is(path);
-    if(!is.good()) continue;
-    std::getline(is, cmdline, '\0');
-    if(!is.good()) continue;
-    const auto base = std::filesystem::path(cmdline).filename();
-    const auto& bstr = base.string();
-    if(std::any_of(cmds.begin(), cmds.end(), [&](const char* s) { return bstr == s; }))
+cmd_watcher::cmd_watcher(const cmd_matcher& matcher)
+  : matcher_(matcher)
+  , proc_fd_(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+{
+  if(proc_fd_ == -1) return;
+  std::vector<pid_t> pids;
+  list_pids(proc_fd_, pids);
+  identity id;
+  for(auto pid : pids)
+    if(read_identity(proc_fd_, pid, id))
+      seen_.emplace(pid, id);
+}
+
+cmd_watcher::~cmd_watcher() {
+  if(proc_fd_ != -1)
+    close(proc_fd_);
+}
+
+void cmd_watcher::poll(std::vector<pid_t>& pids) {
+  if(proc_fd_ == -1) return;
+  // An exec creates no pid: every process is looked at
+  std::vector<pid_t> current;
+  lseek(proc_fd_, 0, SEEK_SET); // List /proc again
+  list_pids(proc_fd_, current);
+  std::unordered_map<pid_t, identity> seen;
+  seen.reserve(current.size());
+  identity id;
+  for(auto pid : current) {
+    if(!read_identity(proc_fd_, pid, id)) continue;
+    const auto it = seen_.find(pid);
+    if((it == seen_.end() || it->second != id) && match_cmd(matcher_, proc_fd_, pid))
       pids.push_back(pid);
+    seen.emplace(pid, id);
   }
+  seen_.swap(seen);
+}
+
+pid_t last_created_pid() {
+  char buf[128];
+  if(read_at(AT_FDCWD, "/proc/loadavg", buf, sizeof(buf)) <= 0) return 0;
+  const char* space = strrchr(buf, ' ');
+  return space ? atoi(space + 1) : 0;
+}
+
+void find_children(pid_t pid, std::vector<pid_t>& children) {
+  const std::string task   = std::string("/proc/") + std::to_string(pid) + "/task";
+  const int         dir_fd = open(task.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if(dir_fd == -1) return;
+
+  pid_t child;
+  for_each_entry(dir_fd, [&](const char* name, unsigned char) {
+      std::ifstream is(task + '/' + name + "/children");
+      while(is >> child)
+        children.push_back(child);
+    });
+  close(dir_fd);
 }
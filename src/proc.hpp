@@ -1,35 +1,275 @@
 #ifndef __PROC_H__
 #define __PROC_H__
 
+#include <regex.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <string>
-#include <src/timespec.hpp>
+#include <cstring>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <src/mono_time.hpp>
 #include <src/file_info.hpp>
+#include <src/inotify_watches.hpp>
 
+class file_filter;
 
+
+// Files and io counters of a process from /proc. The descriptors are
+// listed from /proc/pid/fd and their offsets read from
+// /proc/pid/fdinfo.
+//
+// Each descriptor is classified (regular file or not, accepted by the
+// filter or not) from its link in /proc/pid/fd, and the verdict is
+// cached per (fd, inode): sockets, pipes and anonymous inodes are never
+// stat'ed, and the files already known are stat'ed only once. A path is
+// matched by its link target: a file accepted and replaced by another
+// with the same path is found when sampled, by its inode in fdinfo. A
+// path rejected is stat'ed and classified again only at a listing
+// after the size of the fd table changed: until then, the verdict on a
+// rejected path is kept per path.
+//
+// The descriptors are listed only every list_every updates, or when
+// the size of the fd table (FDSize in /proc/pid/status) changes, or
+// when a descriptor sampled was closed. In between, only the offsets
+// of the known files are read.
+//
+// With inotify watches, a file known unchanged since its last sample is
+// not read: its offset is the same and its speed 0.
+//
+// With a budget, at most budget fdinfo are read per update: half of it
+// goes to the recently active files, kept in a set of their own, the
+// rest to a round robin over all the files. The other files keep their
+// last sample. Every file is sampled at least every
+// ceil(2 * nb_files / budget) updates. The descriptors are listed again
+// at most once per round, and the listing is spread over the updates:
+// each reads up to budget entries of the fd directory, held open, from
+// where the previous one stopped. The descriptors not found by the end
+// of the listing are closed.
+//
+// The files whose description is sampled through another process
+// (file_info::owner) are not read. They are found closed at the next
+// listing.
 class proc_file_info : public file_info_updater {
+  // Verdict on a descriptor
+  struct fd_class {
+    ino_t         ino;     // From the link target ("socket:[ino]") or stat
+    bool          keep;    // Regular (or force) and accepted by the filter
+    interned_path target;  // Link target of a path, empty otherwise
+    uint64_t      listing; // Last listing which found the descriptor
+  };
+
   const std::string fdinfo_;
+  const int         fdinfo_fd_;     // Directory fdinfo_, -1 if not opened
   const std::string fd_;
+  const int         fd_fd_;         // Directory fd_, -1 if not opened
   const std::string ioinfo_;
+  const std::string status_;
   const bool        force_;
+  const size_t      budget_;        // 0 for no limit
+  const unsigned    list_every_;    // 0 or 1 to list at every update
+  size_t            cursor_;        // Next file of the round robin
+  bool              listing_;       // Listing in progress, resumed at the next update
+  bool              recheck_;       // FDSize changed: stat the rejected paths again
+  unsigned          ticks_;         // Updates since the last listing
+  long              fdsize_;        // FDSize at the last update
+  std::shared_ptr<inotify_watches>   watches_;  // nullptr for no watches
+  std::unordered_multiset<int>       held_;     // Watches added by this process
+  uint64_t                           last_poll_;
+  std::unordered_map<int, fd_class>  classes_;  // Verdicts of the open descriptors
+  std::unordered_map<int, ino_t>     active_;   // Active files with a budget, fd -> inode
+  int                                active_next_; // fd of the next active file, -1 for any
+  uint64_t                           listings_; // Number of listings
+  std::shared_ptr<const file_filter> filter_;   // nullptr for all files
 
 public:
-  explicit proc_file_info(pid_t pid, bool force = false, bool numeric = false)
+  explicit proc_file_info(pid_t pid, bool force = false, bool numeric = false, size_t budget = 0,
+                          unsigned list_every = 1, std::shared_ptr<inotify_watches> watches = nullptr,
+                          std::shared_ptr<const file_filter> filter = nullptr)
     : file_info_updater(pid, create_identifier(numeric, pid))
     , fdinfo_(std::string("/proc/") + std::to_string(pid) + "/fdinfo")
+    , fdinfo_fd_(open(fdinfo_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))
     , fd_(std::string("/proc/") + std::to_string(pid) + "/fd")
+    , fd_fd_(open(fd_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))
     , ioinfo_(std::string("/proc/") + std::to_string(pid) + "/io")
+    , status_(std::string("/proc/") + std::to_string(pid) + "/status")
     , force_(force)
+    , budget_(budget)
+    , list_every_(list_every)
+    , cursor_(0)
+    , listing_(false)
+    , recheck_(false)
+    , ticks_(0)
+    , fdsize_(-1)
+    , watches_(std::move(watches))
+    , last_poll_(0)
+    , active_next_(-1)
+    , listings_(0)
+    , filter_(std::move(filter))
   { }
+  virtual ~proc_file_info();
 
-  virtual bool update_file_info(file_list& list, const timespec& stamp);
-  virtual bool update_io_info(io_info& info, const timespec& stamp);
+  virtual bool update_file_info(file_list& list, const mono_time& stamp);
+  virtual bool update_io_info(io_info& info, const mono_time& stamp);
 
 protected:
-  bool update_file_info(file_info& info, const timespec& stamp, std::istream& in, const bool is_new);
+  // True if the descriptors must be listed at this update
+  bool need_enumerate();
+  // List the descriptors. New files are added and the files still open
+  // are marked updated.
+  bool enumerate(file_list& list);
+  // Start a listing, from the first entry of the fd directory
+  bool start_listing();
+  // Continue the listing in progress with up to nb entries, and end it
+  // if they were the last ones
+  bool resume_listing(file_list& list, size_t nb);
+  // After the last entry: the files whose descriptor was not listed are
+  // marked not updated
+  virtual void end_listing(file_list& list);
+  // Classify the descriptor name of the fd directory, and add its file
+  // to list if new
+  void list_fd(file_list& list, const char* name);
+  // Read the fdinfo of a file and update its offset and speeds. Returns
+  // false, and marks the file not updated, if its descriptor was closed
+  // or reused for another file.
+  virtual bool sample(file_info& info);
+  // Update the speeds of a file just sampled, previous being its offset
+  // at the previous sample
+  static void update_rates(file_info& info, off_t previous, bool is_new);
+  // The file is known unchanged: same offset at time now
+  void skip(file_info& info, const mono_time& now);
+  // Whether the descriptor of a file known unchanged still refers to
+  // the description sampled, checked before it is skipped
+  virtual bool same_description(const file_info& info) { return true; }
+  // Remove the watches of the closed files
+  void release_watches(file_list& list);
+  // Parse the content of a fdinfo file, a nul terminated string.
+  // Returns false if it is for another inode.
+  static bool parse_fdinfo(file_info& info, const char* buf, const bool is_new);
 };
 
-// Find add the process with a command that match a word in <cmds>, and append
-// to pids.
-void find_cmds(const std::vector<const char*>& cmds, std::vector<pid_t>& pids);
+// Files of a process sampled through duplicates of its descriptors,
+// obtained with pidfd_getfd(2) (Linux 5.6). A duplicate shares the open
+// file description with the process: the offset is read with lseek(2)
+// and the size with fstat(2), without opening and parsing a fdinfo
+// file. kcmp(2) checks at every sample that the descriptor of the
+// process still refers to the same description.
+//
+// A descriptor is duplicated when its file is first sampled, and the
+// duplicate kept until a sample, a listing or the kcmp check of a file
+// skipped with inotify finds the descriptor closed: until then, the
+// description is still open in pvof, with its flock(2) locks and
+// leases, and a deleted file is not freed. Without the
+// permission to ptrace the process, or on older kernels, the offsets
+// are read from fdinfo as with proc_file_info.
+//
+// The duplicates of all the processes are limited below the limit on
+// open files (RLIMIT_NOFILE, whose soft limit is raised to the hard
+// limit), leaving room for the other descriptors of pvof. Past that,
+// or if the system runs out of descriptors, the offsets of the other
+// files are read from fdinfo.
+class getfd_file_info : public proc_file_info {
+  std::unordered_map<int, int> dups_;  // Descriptor of the process -> duplicate, -1 to read fdinfo
+  const bool                   own_;   // The process is pvof: its descriptors are used as is
+  const pid_t                  self_;
+  bool                         getfd_; // Duplication allowed
+
+public:
+  explicit getfd_file_info(pid_t pid, bool force = false, bool numeric = false, size_t budget = 0,
+                           unsigned list_every = 1, std::shared_ptr<inotify_watches> watches = nullptr,
+                           std::shared_ptr<const file_filter> filter = nullptr);
+  virtual ~getfd_file_info();
+
+  // Number of descriptors duplicated
+  size_t duplicates() const;
+
+protected:
+  virtual void end_listing(file_list& list);
+  virtual bool sample(file_info& info);
+  // Compare the duplicate with the descriptor of the process (kcmp), so
+  // that a file skipped with inotify does not keep its description open
+  virtual bool same_description(const file_info& info);
+  // Duplicate of the descriptor of a file, -1 to read its fdinfo
+  int duplicate(const file_info& info);
+  void release(int dup);
+};
+
+// Match command names against patterns: exact names, shell globs or
+// extended regular expressions (unanchored, as pgrep). The name is the
+// base name of argv[0] or, if full is true, the whole command line with
+// the arguments separated by spaces.
+class cmd_matcher {
+public:
+  enum mode_type { EXACT, GLOB, REGEX };
+
+private:
+  const std::vector<const char*> patterns_;
+  std::vector<regex_t>           regexes_;
+  const mode_type                mode_;
+  const bool                     full_;
+  std::string                    error_;
+
+public:
+  explicit cmd_matcher(const std::vector<const char*>& patterns, mode_type mode = EXACT, bool full = false);
+  ~cmd_matcher();
+  cmd_matcher(const cmd_matcher&) = delete;
+  cmd_matcher& operator=(const cmd_matcher&) = delete;
+
+  // Empty if all the patterns are valid, otherwise an error message
+  const std::string& error() const { return error_; }
+  bool full() const { return full_; }
+  bool match(const char* name) const;
+};
+
+// Whether the command of pid matches. proc_fd is a directory file
+// descriptor on /proc. A process without command line (e.g. a kernel
+// thread) is matched by its comm.
+bool match_cmd(const cmd_matcher& matcher, int proc_fd, pid_t pid);
+
+// Append to pids the processes with a command matching. The entries of
+// /proc are listed with getdents64 and the commands are checked by up
+// to threads threads.
+void find_cmds(const cmd_matcher& matcher, std::vector<pid_t>& pids, unsigned threads = 1);
+
+// Discover the processes matching a cmd_matcher which start after its
+// creation. Either check each process reported by the process
+// connector, or poll /proc. A poll checks the pids not seen at the
+// previous poll, and the processes whose command name or start time
+// changed since: a process which exec'ed, with or without forking
+// first, or a pid reused.
+class cmd_watcher {
+  // Identity of a process, from /proc/pid/stat
+  struct identity {
+    unsigned long long start; // Start time, in clock ticks
+    char               comm[16];
+    bool operator==(const identity& rhs) const { return start == rhs.start && !strcmp(comm, rhs.comm); }
+    bool operator!=(const identity& rhs) const { return !(*this == rhs); }
+  };
+  const cmd_matcher&                  matcher_;
+  const int                           proc_fd_;
+  std::unordered_map<pid_t, identity> seen_; // Processes at previous poll
+
+  static bool read_identity(int proc_fd, pid_t pid, identity& id);
+
+public:
+  explicit cmd_watcher(const cmd_matcher& matcher);
+  ~cmd_watcher();
+  cmd_watcher(const cmd_watcher&) = delete;
+  cmd_watcher& operator=(const cmd_watcher&) = delete;
+
+  // Whether the process pid, which just forked or exec'ed, matches
+  bool check(pid_t pid) const { return proc_fd_ != -1 && match_cmd(matcher_, proc_fd_, pid); }
+  // Append to pids the new matching processes since the last poll
+  void poll(std::vector<pid_t>& pids);
+};
+
+// Last pid created in the pid namespace, from /proc/loadavg. 0 if
+// unknown.
+pid_t last_created_pid();
+
+// Append to children the pids of the children processes of all the
+// threads of pid.
+void find_children(pid_t pid, std::vector<pid_t>& children);
 
 #endif /* __PROC_H__ */
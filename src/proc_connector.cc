@@ -0,0 +1,103 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+
+#ifdef HAVE_LINUX_CN_PROC_H
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#endif
+
+#include <src/proc_connector.hpp>
+
+#ifdef HAVE_LINUX_CN_PROC_H
+proc_connector::proc_connector()
+  : fd_(socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR))
+{
+  if(fd_ == -1) return;
+
+  sockaddr_nl addr;
+  memset(&addr, '\0', sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  addr.nl_pid    = 0; // Assigned by the kernel
+  if(bind(fd_, (sockaddr*)&addr, sizeof(addr)) == -1) goto failed;
+
+  { // Subscription message: netlink header, connector header, operation
+    char __attribute__((aligned(NLMSG_ALIGNTO))) msg[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))];
+    memset(msg, '\0', sizeof(msg));
+    nlmsghdr* nl_hdr   = (nlmsghdr*)msg;
+    nl_hdr->nlmsg_len  = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+    nl_hdr->nlmsg_pid  = getpid();
+    nl_hdr->nlmsg_type = NLMSG_DONE;
+    cn_msg* cn_hdr     = (cn_msg*)NLMSG_DATA(nl_hdr);
+    cn_hdr->id.idx     = CN_IDX_PROC;
+    cn_hdr->id.val     = CN_VAL_PROC;
+    cn_hdr->len        = sizeof(proc_cn_mcast_op);
+    *(proc_cn_mcast_op*)cn_hdr->data = PROC_CN_MCAST_LISTEN;
+    if(send(fd_, msg, nl_hdr->nlmsg_len, 0) == -1) goto failed;
+  }
+  return;
+
+ failed:
+  close(fd_);
+  fd_ = -1;
+}
+
+proc_connector::~proc_connector() {
+  if(fd_ != -1) {
+    close(fd_);
+  }
+}
+
+bool proc_connector::read_events(event_list& events) {
+  if(fd_ == -1) return false;
+
+  char __attribute__((aligned(NLMSG_ALIGNTO))) buf[8192];
+  while(true) {
+    sockaddr_nl from;
+    socklen_t   from_len = sizeof(from);
+    ssize_t     len      = recvfrom(fd_, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+    if(len == -1) {
+      if(errno == EINTR) continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK; // ENOBUFS: lost events
+    }
+    if(from.nl_pid != 0) continue; // Not from the kernel
+
+    for(nlmsghdr* hdr = (nlmsghdr*)buf; NLMSG_OK(hdr, len); hdr = NLMSG_NEXT(hdr, len)) {
+      if(hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_NOOP) continue;
+      const cn_msg*     cn = (const cn_msg*)NLMSG_DATA(hdr);
+      if(cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC) continue;
+      const proc_event* ev = (const proc_event*)cn->data;
+      switch(ev->what) {
+      case proc_event::PROC_EVENT_FORK:
+        if(ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid) break; // New thread
+        events.push_back({ event::FORK, ev->event_data.fork.child_tgid, ev->event_data.fork.parent_tgid });
+        break;
+      case proc_event::PROC_EVENT_EXEC:
+        events.push_back({ event::EXEC, ev->event_data.exec.process_tgid, 0 });
+        break;
+      case proc_event::PROC_EVENT_EXIT:
+        if(ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid) break; // Thread
+        events.push_back({ event::EXIT, ev->event_data.exit.process_tgid, 0 });
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+#else // HAVE_LINUX_CN_PROC_H
+
+proc_connector::proc_connector() : fd_(-1) { }
+proc_connector::~proc_connector() { }
+bool proc_connector::read_events(event_list& events) { return false; }
+
+#endif // HAVE_LINUX_CN_PROC_H
@@ -0,0 +1,37 @@
+#ifndef __PROC_CONNECTOR_H__
+#define __PROC_CONNECTOR_H__
+
+#include <sys/types.h>
+#include <vector>
+
+// Fork, exec and exit events of all the processes of the system, from
+// the netlink process connector. Opening the connector requires
+// CAP_NET_ADMIN: check good() and fall back to polling /proc if it
+// fails.
+class proc_connector {
+  int fd_;
+
+public:
+  struct event {
+    enum type_t { FORK, EXEC, EXIT } type;
+    pid_t pid;    // Process (thread group) id
+    pid_t parent; // Parent process id, for FORK only
+  };
+  typedef std::vector<event> event_list;
+
+  proc_connector();
+  ~proc_connector();
+  proc_connector(const proc_connector&) = delete;
+  proc_connector& operator=(const proc_connector&) = delete;
+
+  bool good() const { return fd_ != -1; }
+  int fd() const { return fd_; }
+
+  // Append all the pending events (does not block). Only the events
+  // concerning processes are reported, not threads. Return false if
+  // some events were lost (the socket buffer overflowed) or on error:
+  // the caller must then rescan /proc.
+  bool read_events(event_list& events);
+};
+
+#endif /* __PROC_CONNECTOR_H__ */
@@ -0,0 +1,123 @@
+#ifndef __PROCESS_TABLE_H__
+#define __PROCESS_TABLE_H__
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <iterator>
+
+#include <src/file_info.hpp>
+
+// A monitored process: how to update it, its files and io counters
+struct process_entry {
+  updater_ptr updater;
+  file_list   files;
+  io_info     io;
+};
+
+// Table of the monitored processes. Entries are stored in slots which
+// are reused after a removal, making insertion and removal O(1). A
+// handle (slot index and generation of the slot) stays valid until its
+// entry is removed. After that, it is detected as stale even if the
+// slot is reused.
+class process_table {
+public:
+  struct handle {
+    uint32_t index;
+    uint32_t generation;
+    bool operator==(const handle& rhs) const { return index == rhs.index && generation == rhs.generation; }
+    bool operator!=(const handle& rhs) const { return !(*this == rhs); }
+  };
+
+private:
+  struct slot {
+    process_entry entry;
+    uint32_t      generation;
+    bool          used;
+  };
+  std::vector<slot>                 slots_;
+  std::vector<uint32_t>             free_;
+  std::unordered_map<pid_t, handle> pids_;
+
+  template<typename Table, typename Entry>
+  class iterator_base {
+    Table*   table_;
+    uint32_t index_;
+    void skip() {
+      while(index_ < table_->slots_.size() && !table_->slots_[index_].used) ++index_;
+    }
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Entry                     value_type;
+    typedef std::ptrdiff_t            difference_type;
+    typedef Entry*                    pointer;
+    typedef Entry&                    reference;
+
+    iterator_base(Table* table, uint32_t index) : table_(table), index_(index) { skip(); }
+    Entry& operator*() const { return table_->slots_[index_].entry; }
+    Entry* operator->() const { return &table_->slots_[index_].entry; }
+    iterator_base& operator++() { ++index_; skip(); return *this; }
+    iterator_base operator++(int) { iterator_base res(*this); ++*this; return res; }
+    bool operator==(const iterator_base& rhs) const { return index_ == rhs.index_; }
+    bool operator!=(const iterator_base& rhs) const { return index_ != rhs.index_; }
+    handle get_handle() const { return { index_, table_->slots_[index_].generation }; }
+  };
+
+public:
+  typedef iterator_base<process_table, process_entry>             iterator;
+  typedef iterator_base<const process_table, const process_entry> const_iterator;
+
+  // Add a process. Its pid must not already be in the table.
+  handle insert(updater_ptr&& updater) {
+    uint32_t index;
+    if(free_.empty()) {
+      index = slots_.size();
+      slots_.push_back({ process_entry(), 0, false });
+    } else {
+      index = free_.back();
+      free_.pop_back();
+    }
+    slot& s          = slots_[index];
+    s.used           = true;
+    s.entry.updater  = std::move(updater);
+    const handle res = { index, s.generation };
+    pids_[s.entry.updater->pid()] = res;
+    return res;
+  }
+
+  // Remove the process. Nothing happens if the handle is stale.
+  void remove(handle h) {
+    if(!get(h)) return;
+    slot& s = slots_[h.index];
+    pids_.erase(s.entry.updater->pid());
+    s.entry = process_entry();
+    s.used  = false;
+    ++s.generation;
+    free_.push_back(h.index);
+  }
+
+  // Entry for handle, or nullptr if the handle is stale
+  process_entry* get(handle h) {
+    if(h.index >= slots_.size()) return nullptr;
+    slot& s = slots_[h.index];
+    return s.used && s.generation == h.generation ? &s.entry : nullptr;
+  }
+  const process_entry* get(handle h) const { return const_cast<process_table*>(this)->get(h); }
+
+  // Entry for pid, or nullptr if not in the table
+  process_entry* find(pid_t pid) {
+    auto it = pids_.find(pid);
+    return it == pids_.end() ? nullptr : get(it->second);
+  }
+  const process_entry* find(pid_t pid) const { return const_cast<process_table*>(this)->find(pid); }
+
+  size_t size() const { return pids_.size(); }
+  bool empty() const { return pids_.empty(); }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, slots_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, slots_.size()); }
+};
+
+#endif /* __PROCESS_TABLE_H__ */
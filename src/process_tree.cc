@@ -0,0 +1,163 @@
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#include <src/process_tree.hpp>
+#include <src/proc.hpp>
+#include <src/tick_arena.hpp>
+#include <src/dir_entries.hpp>
+
+// Read the content of a (small) file of /proc, relative to proc_fd,
+// into buf
+static bool read_proc_file(int proc_fd, const char* path, std::pmr::string& buf) {
+  buf.clear();
+  int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+  if(fd == -1) return false;
+  char    chunk[4096];
+  ssize_t len;
+  while((len = read(fd, chunk, sizeof(chunk))) > 0)
+    buf.append(chunk, len);
+  close(fd);
+  return len == 0;
+}
+
+// Thread count (field 20) and start time (field 22) from
+// /proc/pid/stat. The command name (field 2) may contain spaces and
+// parentheses: the fields are counted from the last ')'.
+static bool read_stat(int proc_fd, pid_t pid, long& threads, unsigned long long& start_time) {
+  char path[64];
+  snprintf(path, sizeof(path), "%d/stat", (int)pid);
+  std::pmr::string buf(tick_arena::instance().resource());
+  if(!read_proc_file(proc_fd, path, buf)) return false;
+  const size_t paren = buf.find_last_of(')');
+  if(paren == std::string::npos) return false;
+  const char* ptr   = buf.c_str() + paren + 1;
+  for(int field = 3; field < 20; ++field) {
+    ptr = strchr(ptr + 1, ' ');
+    if(!ptr) return false;
+  }
+  char* end;
+  threads = strtol(ptr + 1, &end, 10);
+  ptr     = strchr(end + 1, ' '); // Skip field 21
+  if(!ptr) return false;
+  start_time = strtoull(ptr + 1, &end, 10);
+  return end != ptr + 1;
+}
+
+process_tree::process_tree()
+  : last_pid_(0)
+  , proc_fd_(open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+{ }
+
+process_tree::~process_tree() {
+  if(proc_fd_ != -1)
+    close(proc_fd_);
+}
+
+bool process_tree::add_root(pid_t pid) {
+  if(!nodes_.emplace(pid, node{ 0, {}, {}, 0, 0 }).second) return false;
+  roots_.push_back(pid);
+  return true;
+}
+
+bool process_tree::add_child(pid_t parent, pid_t pid) {
+  auto it = nodes_.find(parent);
+  if(it == nodes_.end()) return false;
+  node& n = it->second; // References stay valid after an insertion, iterators may not
+  if(!nodes_.emplace(pid, node{ parent, {}, {}, 0, 0 }).second) return false;
+  n.children.push_back(pid);
+  return true;
+}
+
+void process_tree::remove(pid_t pid) {
+  auto it = nodes_.find(pid);
+  if(it == nodes_.end()) return;
+  node& n = it->second;
+
+  auto parent = n.parent ? nodes_.find(n.parent) : nodes_.end();
+  std::vector<pid_t>& siblings = parent != nodes_.end() ? parent->second.children : roots_;
+  auto                self     = std::find(siblings.begin(), siblings.end(), pid);
+  if(self != siblings.end())
+    siblings.erase(self);
+  for(auto child : n.children) {
+    nodes_[child].parent = parent != nodes_.end() ? n.parent : 0;
+    siblings.push_back(child);
+  }
+  nodes_.erase(it);
+}
+
+void process_tree::scan(std::vector<pid_t>& new_pids) {
+  // Nothing to do if no process or thread was created since last
+  // scan. Otherwise, only check the nodes known at this point and the
+  // new nodes found along the way.
+  const pid_t last_pid = last_created_pid();
+  if(last_pid != 0 && last_pid == last_pid_) return;
+  last_pid_ = last_pid;
+
+  std::pmr::vector<pid_t> queue(tick_arena::instance().resource());
+  queue.reserve(nodes_.size());
+  for(const auto& it : nodes_)
+    queue.push_back(it.first);
+  for(size_t i = 0; i < queue.size(); ++i) {
+    auto it = nodes_.find(queue[i]);
+    if(it != nodes_.end())
+      scan(queue[i], it->second, new_pids, queue);
+  }
+}
+
+void process_tree::scan(pid_t pid, node& n, std::vector<pid_t>& new_pids, std::pmr::vector<pid_t>& queue) {
+  long               threads;
+  unsigned long long start_time;
+  if(!read_stat(proc_fd_, pid, threads, start_time) || (n.start_time && n.start_time != start_time)) {
+    remove(pid); // Reaped, or pid reused
+    return;
+  }
+  n.start_time = start_time;
+
+  char path[64];
+  if(threads != n.threads) { // List the threads again
+    n.threads = threads;
+    n.tasks.clear();
+    snprintf(path, sizeof(path), "%d/task", (int)pid);
+    const int dir_fd = openat(proc_fd_, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dir_fd == -1) return;
+    for_each_entry(dir_fd, [&](const char* name, unsigned char) { n.tasks.push_back(std::atoi(name)); });
+    close(dir_fd);
+  }
+
+  std::pmr::string buf(tick_arena::instance().resource());
+  for(auto tid : n.tasks) {
+    snprintf(path, sizeof(path), "%d/task/%d/children", (int)pid, (int)tid);
+    if(!read_proc_file(proc_fd_, path, buf)) continue;
+    const char* ptr = buf.c_str();
+    char*       end;
+    for(pid_t child = strtol(ptr, &end, 10); end != ptr; child = strtol(ptr, &end, 10)) {
+      ptr = end;
+      if(nodes_.count(child)) continue;
+      nodes_.emplace(child, node{ pid, {}, {}, 0, 0 });
+      n.children.push_back(child);
+      new_pids.push_back(child);
+      queue.push_back(child);
+    }
+  }
+}
+
+void process_tree::order(order_type& res) const {
+  res.clear();
+  res.reserve(nodes_.size());
+  for(auto pid : roots_)
+    order(pid, 0, res);
+}
+
+void process_tree::order(pid_t pid, int depth, order_type& res) const {
+  res.push_back({ pid, depth });
+  const auto it = nodes_.find(pid);
+  if(it == nodes_.end()) return;
+  for(auto child : it->second.children)
+    order(child, depth + 1, res);
+}
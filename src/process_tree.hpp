@@ -0,0 +1,63 @@
+#ifndef __PROCESS_TREE_H__
+#define __PROCESS_TREE_H__
+
+#include <sys/types.h>
+#include <vector>
+#include <utility>
+#include <memory_resource>
+#include <unordered_map>
+
+// Tree of the followed processes. The roots are the processes given on
+// the command line, the other nodes their descendants. A node stays in
+// the tree until its process is reaped, even if it is not monitored
+// (e.g. a zombie), so that it is not found again as a new child.
+//
+// The tree is maintained incrementally, either from fork/exit events
+// or by scan(). A scan does nothing if no process was created on the
+// system since the previous scan, and the threads of a process are
+// listed again only if its thread count changed.
+class process_tree {
+  struct node {
+    pid_t              parent;     // 0 for a root
+    std::vector<pid_t> children;
+    std::vector<pid_t> tasks;      // Threads, whose children files are read
+    unsigned long long start_time; // Detects pid reuse. 0 if unknown
+    long               threads;
+  };
+  std::unordered_map<pid_t, node> nodes_;
+  std::vector<pid_t>              roots_;
+  pid_t                           last_pid_; // Last pid created at previous scan
+  const int                       proc_fd_;  // Directory /proc
+
+public:
+  typedef std::pmr::vector<std::pair<pid_t, int>> order_type; // pid and depth
+
+  process_tree();
+  ~process_tree();
+  process_tree(const process_tree&) = delete;
+  process_tree& operator=(const process_tree&) = delete;
+
+  bool contains(pid_t pid) const { return nodes_.count(pid) > 0; }
+  size_t size() const { return nodes_.size(); }
+
+  // Add a root process. Return false if already in the tree.
+  bool add_root(pid_t pid);
+  // Add pid as a child of parent. Return false if parent is not in the
+  // tree or pid already is.
+  bool add_child(pid_t parent, pid_t pid);
+  // Remove a process. Its children are moved to its parent.
+  void remove(pid_t pid);
+
+  // Poll /proc for new children, and for dead processes which are
+  // removed. The pids of the new children are appended to new_pids.
+  void scan(std::vector<pid_t>& new_pids);
+
+  // Processes in depth first order, with their depth
+  void order(order_type& res) const;
+
+protected:
+  void order(pid_t pid, int depth, order_type& res) const;
+  void scan(pid_t pid, node& n, std::vector<pid_t>& new_pids, std::pmr::vector<pid_t>& queue);
+};
+
+#endif /* __PROCESS_TREE_H__ */
@@ -6,26 +6,40 @@
 #include <signal.h>
 #include <cstdlib>
 #include <cerrno>
+#include <cstdio>
+#include <cinttypes>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
 #include <vector>
-#include <set>
+#include <map>
+#include <memory>
 
 #include <src/pipe_open.hpp>
 #include <src/lsof.hpp>
 #include <src/print_info.hpp>
-#include <src/timespec.hpp>
+#include <src/mono_time.hpp>
 #include <src/pvof.hpp>
 #include <src/proc.hpp>
+#include <src/proc_connector.hpp>
+#include <src/pidfd.hpp>
+#include <src/process_table.hpp>
+#include <src/process_tree.hpp>
+#include <src/file_filter.hpp>
+#include <src/tick_arena.hpp>
+#include <src/fd_trace.hpp>
+#include <src/shared_files.hpp>
 
 pvof args; // The arguments
 volatile bool done = false; // Done if we catch a signal
 volatile bool no_display = false; // Stop display of file status
+std::shared_ptr<const file_filter> files_filter; // Files to monitor, nullptr for all
+std::ostream*                      trace_output; // Output of --trace
 
 // Stop on TERM and QUIT signals
 void sig_termination_handler(int s) {
@@ -51,46 +65,19 @@ void prepare_termination() {
 
 
 pid_t start_sub_command(std::vector<const char*> args) {
-  int pipefd[2];
-  if(pipe(pipefd) == -1) { // Don't report error but disable error reporting!
-    pipefd[0] = pipefd[1] = -1;
-  } else {
-    fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
-  }
-
-  pid_t pid = fork();
-  if(pid == 0) { // child
-    close(pipefd[0]);
-    const char** cmd = new const char*[args.size() + 1];
-    std::copy(args.begin(), args.end(), cmd);
-    cmd[args.size()] = 0;
-    execvp(cmd[0], (char* const*)cmd);
-    // Got here -> execvp failed!
-    int exit_code = 1;
-    if(pipefd[1] != -1) {
-      auto s = write(pipefd[1], &errno, sizeof(errno));
-      if(s == -1)
-        exit_code = 2;
-      close(pipefd[1]);
-    }
-    _exit(exit_code);
-  } else { // parent
-    close(pipefd[1]);
-    if(pipefd[0] != -1) {
-      int res = read(pipefd[0], &errno, sizeof(errno));
-      close(pipefd[0]);
-      if(res != 0)
-        return -1;
-    }
-  }
-
-  return pid;
+  args.push_back(nullptr);
+  return spawn_command(args.data());
 }
 
-void wait_sub_command(pid_t pid, bool forever = false) {
+void wait_sub_command(pid_t pid, const pid_fd& pidfd, bool forever = false) {
   // Wait for sub command for at most 1 second
-  if(!forever)
-    alarm(1);
+  if(!forever) {
+    if(pidfd.good()) {
+      if(!pidfd.wait(1000)) return;
+    } else {
+      alarm(1);
+    }
+  }
   int status;
   pid_t res = waitpid(pid, &status, 0);
   switch(res) {
@@ -117,99 +104,311 @@ void wait_sub_command(pid_t pid, bool forever = false) {
   exit(EXIT_FAILURE);
 }
 
+// Create the updater and the file and io lists of a new process. A
+// process which already exited (e.g. a zombie) is not added, nor a
+// process already monitored: a second updater for it would unregister
+// it from the lsof runs when destroyed.
+bool add_process(pid_t pid, process_table& processes, std::shared_ptr<lsof_batch>& lsof_runs,
+                 const mono_time& time_tick) {
+  if(processes.find(pid))
+    return false;
+  updater_ptr updater;
+#ifdef HAVE_PROC
+  // One inotify instance for all the processes
+  static std::shared_ptr<inotify_watches> watches(args.inotify_flag ? new inotify_watches : nullptr);
+  if(args.getfd_flag && !args.lsof_flag)
+    updater.reset(new getfd_file_info(pid, args.force_flag, args.numeric_flag, args.fd_budget_arg,
+                                      args.list_every_arg, watches, files_filter));
+  else if(!args.lsof_flag)
+    updater.reset(new proc_file_info(pid, args.force_flag, args.numeric_flag, args.fd_budget_arg,
+                                     args.list_every_arg, watches, files_filter));
+  else
+#endif
+    updater.reset(new lsof_file_info(pid, args.numeric_flag, lsof_runs, files_filter));
+  if(updater->exited())
+    return false;
+  process_entry* entry = processes.get(processes.insert(std::move(updater)));
+  entry->updater->update_io_info(entry->io, time_tick);
+  return true;
+}
+
+// Time between the first and last file sampled in the last update,
+// the descriptors opened and closed found by the listings, and the
+// files not read because known unchanged, and the allocations since
+// the previous update. Written into status, reusing its memory.
+void scan_skew(const process_table& processes, std::string& status) {
+  size_t   nb_files = 0;
+  mono_time first;
+  mono_time last;
+  size_t    listed = 0, opened = 0, closed = 0, skipped = 0, unnamed = 0;
+  // Allocations since the previous update
+  static uint64_t last_count = 0;
+  const uint64_t  count      = allocation_count();
+  const uint64_t  allocs     = count - last_count;
+  last_count                 = count;
+  for(const auto& process : processes) {
+    const update_stats& stats = process.updater->stats();
+    listed  += stats.listed;
+    opened  += stats.opened;
+    closed  += stats.closed;
+    skipped += stats.skipped;
+    unnamed += stats.unnamed;
+    for(const auto& file : process.files) {
+      if(!file.updated || file.owner || file.stamp < process.io.stamp) continue; // Not sampled at this update
+      if(nb_files == 0 || file.stamp < first) first = file.stamp;
+      if(nb_files == 0 || last < file.stamp) last = file.stamp;
+      ++nb_files;
+    }
+  }
+  char buf[256];
+  snprintf(buf, sizeof(buf), "Scan: %s files, skew%ss, listed %zu, fds +%zu -%zu, skipped %s, unnamed %zu, allocs %" PRIu64,
+           numerical_field_to_str(nb_files).c_str(), numerical_field_to_str(to_seconds(last - first)).c_str(),
+           listed, opened, closed, numerical_field_to_str(skipped).c_str(), unnamed, allocs);
+  status.assign(buf);
+}
+
+// Find the names of the files about to be displayed
+void resolve_names(process_table& processes, const mono_time& stamp) {
+  for(auto it = processes.begin(); it != processes.end(); ++it)
+    it->updater->resolve_names(it->files, stamp);
+}
+
+// Remove the processes in dead
+void remove_processes(std::pmr::vector<process_table::handle>& dead, process_tree& tree, process_table& processes) {
+  for(const auto h : dead) {
+    const process_entry* entry = processes.get(h);
+    if(!entry) continue;
+    tree.remove(entry->updater->pid());
+    processes.remove(h);
+  }
+  dead.clear();
+}
+
+// Sleep until time_tick. If cleaning is enabled, the processes exiting
+// in the meantime are removed immediately: wait on their pidfd.
+void wait_next_tick(const mono_time& time_tick, process_tree& tree, process_table& processes,
+                    tty_writer& writer, const std::string& status) {
+  std::pmr::vector<pollfd>                fds(tick_arena::instance().resource());
+  std::pmr::vector<process_table::handle> dead(tick_arena::instance().resource());
+  while(!done) {
+    const mono_time now = mono_now();
+    if(!(now < time_tick)) break;
+
+    fds.clear();
+    if(args.clean_arg)
+      for(const auto& entry : processes)
+        if(entry.updater->pidfd().good())
+          fds.push_back({ entry.updater->pidfd().fd(), POLLIN, 0 });
+    if(fds.empty()) {
+      const timespec until = to_timespec(time_tick);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, 0);
+      break;
+    }
+
+    if(poll(fds.data(), fds.size(), timeout_ms(now, time_tick)) <= 0) continue; // Timeout or signal
+    for(auto it = processes.begin(); it != processes.end(); ++it)
+      if(it->updater->exited())
+        dead.push_back(it.get_handle());
+    remove_processes(dead, tree, processes);
+    if(processes.empty()) break;
+    if(!no_display) {
+      resolve_names(processes, mono_now());
+      print_file_list(processes, tree, writer, status);
+    }
+  }
+}
+
 #ifdef HAVE_PROC
-void update_pid_children(std::set<pid_t>& pid_set, updater_list_type& updaters, list_of_file_list& files,
-                         io_info_list& info_ios) {
-  std::string pid_str;
-  std::string path;
-  pid_t       npid;
-  timespec time_tick;
-  clock_gettime(CLOCK_MONOTONIC, &time_tick);
-  for(auto pid : pid_set) {
-    pid_str = std::to_string(pid);
-    path = "/proc/";
-    path += pid_str;
-    path += "/task/";
-    path += pid_str;
-    path += "/children";
-    std::ifstream is(path);
-    while(is >> npid) {
-      auto is_new = pid_set.insert(npid);
-      if(is_new.second) { // new pid inserted
-        if(!args.lsof_flag)
-          updaters.emplace_back(new proc_file_info(npid, args.force_flag, args.numeric_flag));
-        else
-          updaters.emplace_back(new lsof_file_info(npid, args.numeric_flag));
-        files.push_back(file_list());
-        info_ios.push_back(io_info());
-        updaters.back()->update_io_info(info_ios.back(), time_tick);
+// Poll /proc for the children of the processes in the tree
+void update_pid_children(process_tree& tree, process_table& processes,
+                         std::shared_ptr<lsof_batch>& lsof_runs) {
+  std::vector<pid_t> children;
+  tree.scan(children);
+  const mono_time time_tick = mono_now();
+  for(auto npid : children)
+    add_process(npid, processes, lsof_runs, time_tick);
+}
+
+// Add a newly discovered process matching -c
+void add_watched_process(pid_t pid, process_tree& tree, process_table& processes,
+                         std::shared_ptr<lsof_batch>& lsof_runs, const mono_time& time_tick) {
+  if(tree.add_root(pid) && !add_process(pid, processes, lsof_runs, time_tick))
+    tree.remove(pid);
+}
+
+// Follow the children of the processes in the tree (with -F) and
+// discover the processes matching -c (if watcher is not null) from the
+// events of the process connector. Return false if events were lost.
+bool read_pid_events(proc_connector& connector, process_tree& tree, process_table& processes,
+                     std::shared_ptr<lsof_batch>& lsof_runs, const cmd_watcher* watcher) {
+  proc_connector::event_list events;
+  const bool complete = connector.read_events(events);
+
+  // A child that forks and exits between two ticks is in the tree
+  // until its exit, to find its own children, but it is not displayed.
+  std::map<pid_t, size_t> last_exit;
+  for(size_t i = 0; i < events.size(); ++i)
+    if(events[i].type == proc_connector::event::EXIT)
+      last_exit[events[i].pid] = i;
+
+  const mono_time time_tick = mono_now();
+  for(size_t i = 0; i < events.size(); ++i) {
+    const auto& ev = events[i];
+    switch(ev.type) {
+    case proc_connector::event::FORK: {
+      auto       exit  = last_exit.find(ev.pid);
+      const bool alive = exit == last_exit.end() || exit->second < i;
+      if(args.follow_flag && tree.add_child(ev.parent, ev.pid)) {
+        if(alive)
+          add_process(ev.pid, processes, lsof_runs, time_tick);
+      } else if(watcher && alive && watcher->check(ev.pid)) {
+        add_watched_process(ev.pid, tree, processes, lsof_runs, time_tick);
       }
+      break;
+    }
+
+    case proc_connector::event::EXEC: { // Command name changed
+      process_entry* entry = processes.find(ev.pid);
+      if(entry)
+        entry->updater->strid(create_identifier(args.numeric_flag, ev.pid));
+      else if(watcher && !tree.contains(ev.pid) && watcher->check(ev.pid))
+        add_watched_process(ev.pid, tree, processes, lsof_runs, time_tick);
+      break;
+    }
+
+    case proc_connector::event::EXIT: // Its children move up to its parent
+      tree.remove(ev.pid);
+      break;
     }
   }
+  return complete;
 }
-#endif // HAVE_PROC
 
-bool display_file_progress(const std::vector<pid_t>& pids, tty_writer& writer) {
-  list_of_file_list info_files;
-  io_info_list      info_ios;
-  updater_list_type info_updaters;
-  std::set<pid_t>   pid_set;
+// Poll /proc for the processes matching -c
+void update_watched(cmd_watcher& watcher, process_tree& tree, process_table& processes,
+                    std::shared_ptr<lsof_batch>& lsof_runs) {
+  std::vector<pid_t> pids;
+  watcher.poll(pids);
+  const mono_time time_tick = mono_now();
+  for(auto pid : pids)
+    add_watched_process(pid, tree, processes, lsof_runs, time_tick);
+}
+#endif // HAVE_PROC
 
-  timespec time_tick;
-  if(clock_gettime(CLOCK_MONOTONIC, &time_tick)) {
-    std::cerr << "Can't get time" << std::endl;
-    return false;
+#ifdef HAVE_PROC
+// Start the trace of --trace once its target is found: pid:fd, or the
+// first open file of the monitored processes with this path. Then
+// write the samples of the trace.
+void update_trace(std::unique_ptr<fd_trace>& tracer, process_table& processes, const mono_time& stamp) {
+  if(!tracer) {
+    int pid, fd, len = 0;
+    if(sscanf(args.trace_arg, "%d:%d%n", &pid, &fd, &len) == 2 && args.trace_arg[len] == '\0') {
+      tracer.reset(new fd_trace(pid, fd, args.trace_rate_arg, args.trace_stall_arg / 1000.0, *trace_output));
+    } else {
+      // The names are needed now, even if not displayed (--lsof)
+      resolve_names(processes, stamp);
+      for(const auto& process : processes) {
+        for(const auto& file : process.files) {
+          if(!file.updated || file.name != args.trace_arg) continue;
+          tracer.reset(new fd_trace(process.updater->pid(), file.fd, args.trace_rate_arg,
+                                    args.trace_stall_arg / 1000.0, *trace_output));
+          break;
+        }
+        if(tracer) break;
+      }
+    }
+    if(tracer && !tracer->error().empty())
+      pvof::error() << tracer->error();
   }
+  if(tracer)
+    tracer->drain();
+}
+#endif
+
+// Monitor the processes in pids. If watcher is not null, also monitor
+// the new processes matching -c until interrupted.
+bool display_file_progress(const std::vector<pid_t>& pids, tty_writer& writer, cmd_watcher* watcher) {
+  process_table   processes;
+  process_tree    tree; // Followed processes, including zombies
+  // All the lsof updaters share the same lsof run
+  auto            lsof_runs = std::make_shared<lsof_batch>(args.lsof_jobs_arg, args.seconds_arg);
+
+  mono_time time_tick = mono_now();
 
-  for(const auto pid : pids) {
 #ifdef HAVE_PROC
-    if(!args.lsof_flag)
-      info_updaters.emplace_back(new proc_file_info(pid, args.force_flag, args.numeric_flag));
-    else
+  // Subscribe to the process events before the first scan of
+  // children, to not miss any.
+  std::unique_ptr<proc_connector> connector;
+  if((args.follow_flag || watcher) && !args.no_connector_flag) {
+    connector.reset(new proc_connector);
+    if(!connector->good())
+      connector.reset();
+  }
 #endif
-      info_updaters.emplace_back(new lsof_file_info(pid, args.numeric_flag));
-    info_files.push_back(file_list());
-    info_ios.push_back(io_info());
-    info_updaters.back()->update_io_info(info_ios.back(), time_tick);
-    pid_set.insert(pid);
+
+  for(const auto pid : pids) {
+    add_process(pid, processes, lsof_runs, time_tick);
+    tree.add_root(pid);
   }
 
-  clock_gettime(CLOCK_MONOTONIC, &time_tick);
-  std::vector<size_t> dead_processes;
+  time_tick = mono_now();
+  std::pmr::vector<process_table::handle> dead_processes;
+  bool                                    first_tick = true;
+  std::string                             status;
+  shared_files                            shared;
+#ifdef HAVE_PROC
+  std::unique_ptr<fd_trace>               tracer;
+#endif
   while(!done) {
     bool success = false;
-    // size_t total_lines = 0;
-    for(size_t i = 0; i < info_updaters.size(); ++i) {
-      success = info_updaters[i]->update_io_info(info_ios[i], time_tick) || success;
-      success = info_updaters[i]->update_file_info(info_files[i], time_tick) || success;
-      // total_lines += info_files[i].size();
-      if(args.clean_arg && info_ios[i].dead_count > args.clean_arg)
-        dead_processes.push_back(i);
+    for(auto it = processes.begin(); it != processes.end(); ++it) {
+      // Never read /proc for a pid which may have been reused
+      if(it->updater->exited()) {
+        if(args.clean_arg)
+          dead_processes.push_back(it.get_handle());
+        continue;
+      }
+      success = it->updater->update_io_info(it->io, time_tick) || success;
+      success = it->updater->update_file_info(it->files, time_tick) || success;
+      if(args.keep_closed_arg)
+        it->files.archive_closed(args.keep_closed_arg);
+      if(args.clean_arg && (it->io.dead_count > args.clean_arg || it->updater->exited()))
+        dead_processes.push_back(it.get_handle());
     }
-    if(!success)
+    if(!success && !watcher)
       break;
-    if(!no_display)
-      print_file_list(info_updaters, info_files, info_ios, writer);
+
+#ifdef HAVE_PROC
+    if(args.trace_given)
+      update_trace(tracer, processes, time_tick);
+#endif
 
     // Clean up
-    for(auto it = dead_processes.rbegin(); it != dead_processes.rend(); ++it) {
-      info_ios.erase(info_ios.begin() + *it);
-      info_files.erase(info_files.begin() + *it);
-      pid_set.erase(*it);
+    remove_processes(dead_processes, tree, processes);
+    if(!args.no_dedup_flag)
+      shared.update(processes);
+    if(args.skew_flag)
+      scan_skew(processes, status);
+    if(!no_display) {
+      resolve_names(processes, time_tick);
+      print_file_list(processes, tree, writer, status);
     }
-    dead_processes.clear();
 #ifdef HAVE_PROC
-    if(args.follow_flag)
-      update_pid_children(pid_set, info_updaters, info_files, info_ios);
+    // Poll on first iteration, or if the connector is not available
+    // or lost events.
+    const bool poll = !connector || !read_pid_events(*connector, tree, processes, lsof_runs, watcher) || first_tick;
+    if(poll && args.follow_flag)
+      update_pid_children(tree, processes, lsof_runs);
+    if(poll && watcher)
+      update_watched(*watcher, tree, processes, lsof_runs);
 #endif
+    first_tick = false;
 
-    timespec current_time;
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
-    if(time_tick < current_time) {
-      time_tick  = current_time;
-      time_tick += args.seconds_arg;
-    }
-    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time_tick, 0);
+    const mono_time current_time = mono_now();
+    if(time_tick < current_time)
+      time_tick = current_time + std::chrono::seconds(args.seconds_arg);
+    wait_next_tick(time_tick, tree, processes, writer, status);
+    tick_arena::instance().reset();
   }
 
   return true;
@@ -239,12 +438,51 @@ int main(int argc, char *argv[])
 
   std::vector<pid_t> pids(args.pid_arg.size(), -1);
   std::copy(args.pid_arg.cbegin(), args.pid_arg.cend(), pids.begin());
-  find_cmds(args.cmd_arg, pids);
+  if(args.watch_flag && args.cmd_arg.empty())
+    pvof::error() << "Switch --watch requires a command (-c switch)";
+  std::unique_ptr<cmd_matcher> matcher;
+  std::unique_ptr<cmd_watcher> watcher;
+  if(!args.cmd_arg.empty()) {
+    if(args.glob_flag && args.regex_flag)
+      pvof::error() << "Switches --glob and --regex are mutually exclusive";
+    const auto mode = args.glob_flag ? cmd_matcher::GLOB : (args.regex_flag ? cmd_matcher::REGEX : cmd_matcher::EXACT);
+    matcher.reset(new cmd_matcher(args.cmd_arg, mode, args.full_cmd_flag));
+    if(!matcher->error().empty())
+      pvof::error() << matcher->error();
+    if(args.watch_flag) // Before the scan, to not miss any process
+      watcher.reset(new cmd_watcher(*matcher));
+    find_cmds(*matcher, pids, args.scan_threads_arg);
+  }
+  if(!args.include_arg.empty() || !args.exclude_arg.empty() || !args.mount_arg.empty() || args.min_size_arg > 0) {
+    auto filter = std::make_shared<file_filter>(args.include_arg, args.exclude_arg, args.mount_arg,
+                                                args.min_size_arg, args.path_regex_flag);
+    if(!filter->error().empty())
+      pvof::error() << filter->error();
+    files_filter = filter;
+  }
+  std::ofstream trace_file;
+  if(args.trace_given) {
+#ifndef HAVE_PROC
+    pvof::error() << "Switch --trace requires /proc";
+#endif
+    // The samples would be mixed with the display
+    if(!args.trace_output_given && isatty(1))
+      pvof::error() << "Switch --trace requires --trace-output when the standard output is a terminal";
+    trace_output = &std::cout;
+    if(args.trace_output_given) {
+      trace_file.open(args.trace_output_arg);
+      if(!trace_file.good())
+        pvof::error() << "Can't open trace output '" << args.trace_output_arg << "': " << strerror(errno);
+      trace_output = &trace_file;
+    }
+  }
+  std::unique_ptr<pid_fd> command_pidfd;
   if(!args.command_arg.empty()) {
     pid_t pid = start_sub_command(args.command_arg);
     if(pid == -1)
       pvof::error() << "Command failed to run: " << strerror(errno);
     pids.push_back(pid);
+    command_pidfd.reset(new pid_fd(pid));
   }
 
   prepare_termination();
@@ -258,14 +496,14 @@ int main(int argc, char *argv[])
   tty_writer writer(output, !args.nocolor_flag);
 
   if(!wait_forever) {
-    wait_forever = !display_file_progress(pids, writer);
+    wait_forever = !display_file_progress(pids, writer, watcher.get());
   }
 
 
   // If we started the subprocess, get return value or kill
   // signal. Make pvof "transparent".
   if(!args.command_arg.empty())
-    wait_sub_command(pids.back(), wait_forever);
+    wait_sub_command(pids.back(), *command_pidfd, wait_forever);
 
   return 0;
 }
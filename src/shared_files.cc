@@ -0,0 +1,132 @@
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/kcmp.h>
+#include <cerrno>
+#include <algorithm>
+#include <memory_resource>
+
+#include <src/shared_files.hpp>
+#include <src/tick_arena.hpp>
+
+bool shared_files::same_description(pid_t pid1, int fd1, pid_t pid2, int fd2) {
+#ifdef SYS_kcmp
+  static bool supported = true;
+  if(!supported) return false;
+  const std::pair<pid_t, pid_t> pair(std::min(pid1, pid2), std::max(pid1, pid2));
+  if(denied_.count(pair)) return false;
+  const long res = syscall(SYS_kcmp, pid1, pid2, KCMP_FILE, fd1, fd2);
+  if(res == -1 && errno == ENOSYS)
+    supported = false;
+  else if(res == -1 && errno == EPERM)
+    denied_.insert(pair);
+  return res == 0;
+#else
+  return false;
+#endif
+}
+
+void shared_files::find(process_table& processes) {
+  struct candidate {
+    ino_t                 inode;
+    bool                  owner; // Owner at the previous comparison
+    pid_t                 pid;
+    process_table::handle process;
+    file_info*            file;
+  };
+  std::pmr::memory_resource* const arena = tick_arena::instance().resource();
+  std::pmr::vector<candidate>      candidates(arena);
+  std::pmr::vector<pid_t>          pids(arena);
+  for(auto it = processes.begin(); it != processes.end(); ++it) {
+    pids.push_back(it->updater->pid());
+    for(auto& file : it->files) {
+      const bool owner = file.sharers != nullptr;
+      file.owner       = 0;
+      file.sharers.reset();
+      if(file.updated)
+        candidates.push_back({ file.inode, owner, it->updater->pid(), it.get_handle(), &file });
+    }
+  }
+  // Forget the denials of the processes gone
+  std::sort(pids.begin(), pids.end());
+  for(auto it = denied_.begin(); it != denied_.end(); ) {
+    if(!std::binary_search(pids.begin(), pids.end(), it->first) || !std::binary_search(pids.begin(), pids.end(), it->second))
+      it = denied_.erase(it);
+    else
+      ++it;
+  }
+
+  // By inode, the previous owners first to keep them
+  std::sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) {
+      if(a.inode != b.inode) return a.inode < b.inode;
+      if(a.owner != b.owner) return a.owner;
+      return a.pid < b.pid;
+    });
+
+  groups_.clear();
+  std::pmr::vector<std::pair<size_t, size_t>> owners(arena); // Candidate and group, or -1
+  for(size_t i = 0; i < candidates.size(); ) {
+    size_t end = i + 1;
+    while(end < candidates.size() && candidates[end].inode == candidates[i].inode) ++end;
+    // Compare each descriptor with the first of each description found
+    owners.clear();
+    for(size_t j = i; j < end && end - i > 1; ++j) {
+      candidate& c  = candidates[j];
+      auto       it = std::find_if(owners.begin(), owners.end(), [&](const std::pair<size_t, size_t>& o) {
+          const candidate& oc = candidates[o.first];
+          return oc.pid != c.pid && same_description(oc.pid, oc.file->fd, c.pid, c.file->fd);
+        });
+      if(it == owners.end()) {
+        owners.emplace_back(j, (size_t)-1);
+        continue;
+      }
+      const candidate& oc = candidates[it->first];
+      if(it->second == (size_t)-1) {
+        it->second = groups_.size();
+        groups_.push_back({ { oc.process, oc.file->fd, oc.inode }, { } });
+      }
+      groups_[it->second].copies.push_back({ c.process, c.file->fd, c.inode });
+      c.file->owner = oc.pid;
+    }
+    for(const auto& o : owners) {
+      if(o.second == (size_t)-1) continue;
+      auto sharers = std::make_shared<std::vector<pid_t>>();
+      for(const auto& copy : groups_[o.second].copies)
+        sharers->push_back(processes.get(copy.process)->updater->pid());
+      std::sort(sharers->begin(), sharers->end());
+      sharers->erase(std::unique(sharers->begin(), sharers->end()), sharers->end());
+      candidates[o.first].file->sharers = std::move(sharers);
+    }
+    i = end;
+  }
+}
+
+void shared_files::update(process_table& processes) {
+  bool changed = processes.size() != nb_processes_;
+  for(const auto& process : processes) {
+    const update_stats& stats = process.updater->stats();
+    changed = changed || stats.opened || stats.closed;
+  }
+  nb_processes_ = processes.size();
+  if(changed)
+    find(processes);
+
+  for(const auto& g : groups_) {
+    process_entry* owner = processes.get(g.owner.process);
+    if(!owner) continue;
+    const auto file = owner->files.find(g.owner.fd, g.owner.inode);
+    if(file == owner->files.end() || !file->updated) continue;
+    for(const auto& c : g.copies) {
+      process_entry* entry = processes.get(c.process);
+      if(!entry) continue;
+      const auto copy = entry->files.find(c.fd, c.inode);
+      if(copy == entry->files.end() || !copy->updated) continue;
+      copy->offset  = file->offset;
+      copy->ooffset = file->ooffset;
+      copy->size    = file->size;
+      copy->speed   = file->speed;
+      copy->average = file->average;
+      copy->stamp   = file->stamp;
+      copy->start   = file->start;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef __SHARED_FILES_H__
+#define __SHARED_FILES_H__
+
+#include <sys/types.h>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <src/process_table.hpp>
+
+// Open file descriptions shared by several monitored processes, e.g.
+// inherited by the children of a fork. The descriptors of the same
+// inode in different processes are compared with kcmp(2), which needs
+// the permission to ptrace both processes: the descriptions are not
+// found shared otherwise, and a pair of processes denied is not
+// compared again while both are monitored.
+//
+// A shared description is sampled and displayed by one process, its
+// owner: the file of the owner lists the other processes
+// (file_info::sharers), and the files of the other processes, the
+// copies, get the samples of the owner (file_info::owner). Once
+// owner, a file stays so until it is closed.
+//
+// The descriptions are compared again only when descriptors were found
+// opened or closed, or when processes were added or removed.
+class shared_files {
+  struct member {
+    process_table::handle process;
+    int                   fd;
+    ino_t                 inode;
+  };
+  struct group {
+    member              owner;
+    std::vector<member> copies;
+  };
+  std::vector<group>                  groups_;
+  size_t                              nb_processes_; // At the last comparison
+  std::set<std::pair<pid_t, pid_t>>   denied_;       // Pairs of processes kcmp(2) is denied, lower pid first
+
+  // Compare the descriptions of the open files
+  void find(process_table& processes);
+  // Whether fd1 of pid1 and fd2 of pid2 refer to the same open file
+  // description
+  bool same_description(pid_t pid1, int fd1, pid_t pid2, int fd2);
+
+public:
+  shared_files() : nb_processes_(0) { }
+
+  // After the update of the processes: find the shared descriptions if
+  // the descriptors changed, and copy the samples of the owners to the
+  // copies.
+  void update(process_table& processes);
+  // Number of descriptions shared
+  size_t size() const { return groups_.size(); }
+};
+
+#endif /* __SHARED_FILES_H__ */
@@ -0,0 +1,105 @@
+#include <cstdlib>
+#include <cerrno>
+#include <atomic>
+#include <new>
+#include <config.h>
+
+#include <src/tick_arena.hpp>
+
+tick_arena::tick_arena(size_t size)
+  : buffer_(new char[size])
+  , size_(size)
+  , overflow_(0)
+{
+  resource_.emplace(buffer_.get(), size_, static_cast<std::pmr::memory_resource*>(this));
+}
+
+tick_arena& tick_arena::instance() {
+  static tick_arena arena;
+  return arena;
+}
+
+void* tick_arena::do_allocate(size_t bytes, size_t alignment) {
+  overflow_ += bytes;
+  return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void tick_arena::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+void tick_arena::reset() {
+  resource_->release();
+  if(overflow_ == 0) return;
+  // Room for the whole update next time
+  size_    += overflow_;
+  overflow_ = 0;
+  resource_.reset();
+  buffer_.reset(new char[size_]);
+  resource_.emplace(buffer_.get(), size_, static_cast<std::pmr::memory_resource*>(this));
+}
+
+// Count the allocations. The scan threads allocate too.
+static std::atomic<uint64_t> allocations(0);
+
+uint64_t allocation_count() { return allocations.load(std::memory_order_relaxed); }
+
+#if defined(COUNT_MALLOC) && defined(__GLIBC__)
+// Count the calls to the allocation functions of the C library (e.g.
+// by opendir(3)) and of operator new, replaced by forwarding to the
+// allocator of glibc. Only with --enable-count-malloc: the replacement
+// costs an atomic increment on every allocation of the program.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nb, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void  __libc_free(void* p);
+
+void* malloc(size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t nb, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(nb, size);
+}
+
+void* realloc(void* p, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+  return memalign(alignment, size);
+}
+
+int posix_memalign(void** res, size_t alignment, size_t size) noexcept {
+  if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  void* p = memalign(alignment, size);
+  if(!p) return ENOMEM;
+  *res = p;
+  return 0;
+}
+
+void free(void* p) noexcept { __libc_free(p); }
+}
+#else
+// Count the calls to operator new only
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if(void* res = malloc(size ? size : 1))
+    return res;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#endif
@@ -0,0 +1,45 @@
+#ifndef __TICK_ARENA_H__
+#define __TICK_ARENA_H__
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <memory_resource>
+
+// Memory for the temporary data of one update (listing, sampling and
+// display): a monotonic buffer, released at the end of the update. If
+// an update needs more than the buffer, the buffer grows at the next
+// reset, so that a steady state update does not call malloc for its
+// temporaries.
+//
+// Not thread safe: used from the main loop only.
+class tick_arena : private std::pmr::memory_resource {
+  std::unique_ptr<char[]>                            buffer_;
+  size_t                                             size_;
+  size_t                                             overflow_; // Bytes allocated past buffer_
+  std::optional<std::pmr::monotonic_buffer_resource> resource_;
+
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const std::pmr::memory_resource& rhs) const noexcept override { return this == &rhs; }
+
+public:
+  explicit tick_arena(size_t size = 64 * 1024);
+  tick_arena(const tick_arena&) = delete;
+  tick_arena& operator=(const tick_arena&) = delete;
+
+  // The arena of the main loop
+  static tick_arena& instance();
+
+  std::pmr::memory_resource* resource() { return &*resource_; }
+  size_t size() const { return size_; }
+  // Free all the memory of the update
+  void reset();
+};
+
+// Number of memory allocations since the start of the program: calls
+// to operator new, or to the allocation functions of the C library when
+// configured with --enable-count-malloc (glibc only)
+uint64_t allocation_count();
+
+#endif /* __TICK_ARENA_H__ */
@@ -0,0 +1,129 @@
+// Compare the lsof -F output parser with the previous getline/sscanf
+// parser. The input is a capture of lsof, e.g. for a process with many
+// open files:
+//
+//   lsof -p <pid> -o0 -o -Fftiao0 > capture
+//   bench_lsof capture 20
+
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <src/lsof.hpp>
+#include <src/mono_time.hpp>
+
+// Previous parser, for reference
+static bool legacy_parse_line(std::string& line, file_info& f, bool& failed) {
+  const char* ptr = line.c_str();
+  const char* const end = ptr + line.size();
+  int fields;
+
+  failed = false;
+  while(ptr < end) {
+    switch(*ptr) {
+    case 'f':
+      if(strcmp("fNOFD", ptr) == 0) {
+        failed = true;
+        return false;
+      }
+      fields = sscanf(ptr, "f%d", &f.fd);
+      if(fields != 1) return false;
+      break;
+    case 't':
+      if(strcmp("tREG", ptr)) return false;
+      break;
+    case 'a':
+      switch(ptr[1]) {
+      case 'r': f.writable = false; break;
+      case 'w': case 'u': f.writable = true; break;
+      default: return false;
+      }
+      break;
+    case 'o':
+      fields = sscanf(ptr, "o0t%ld", &f.offset);
+      if(fields != 1) {
+        fields = sscanf(ptr, "o%li", &f.offset);
+        if(fields != 1) return false;
+      }
+      break;
+    case 's':
+      fields = sscanf(ptr, "s%ld", &f.size);
+      if(fields != 1) return false;
+      break;
+    case 'i':
+      fields = sscanf(ptr, "i%li", &f.inode);
+      if(fields != 1) return false;
+      break;
+    case 'n':
+      f.name = ptr + 1;
+      break;
+    default:
+      return false;
+    }
+    ptr += strlen(ptr) + 1;
+  }
+  return true;
+}
+
+static size_t legacy_parse(const std::string& data) {
+  std::istringstream is(data);
+  std::string        line;
+  size_t             records = 0;
+  while(std::getline(is, line)) {
+    file_info f;
+    bool      failed;
+    if(legacy_parse_line(line, f, failed))
+      ++records;
+  }
+  return records;
+}
+
+static size_t parse(const std::string& data) {
+  static const size_t pipe_size = 64 * 1024; // Simulate reads from a pipe
+  lsof_sections sections;
+  lsof_parser   parser(sections);
+  for(size_t i = 0; i < data.size(); i += pipe_size)
+    parser.feed(data.data() + i, std::min(pipe_size, data.size() - i));
+  parser.finish();
+  size_t records = 0;
+  for(const auto& s : sections)
+    records += s.second.files.size();
+  return records;
+}
+
+template<typename F>
+static double time_it(F f, const std::string& data, int iterations, size_t& records) {
+  const mono_time start = mono_now();
+  for(int i = 0; i < iterations; ++i)
+    records = f(data);
+  return to_seconds(mono_now() - start) / iterations;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " lsof_capture [iterations]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+
+  std::ifstream is(argv[1]);
+  std::ostringstream content;
+  content << is.rdbuf();
+  const std::string data = content.str();
+
+  size_t legacy_records = 0, records = 0;
+  const double legacy_time = time_it(legacy_parse, data, iterations, legacy_records);
+  const double time        = time_it(parse, data, iterations, records);
+
+  std::cout << "bytes " << data.size() << "\n"
+            << "getline/sscanf " << legacy_records << " records " << (legacy_time * 1000) << " ms\n"
+            << "from_chars     " << records << " records " << (time * 1000) << " ms\n"
+            << "speedup        " << (legacy_time / time) << std::endl;
+
+  return legacy_records == records ? EXIT_SUCCESS : EXIT_FAILURE;
+}
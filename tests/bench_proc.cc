@@ -0,0 +1,127 @@
+// Compare the sampling of the file offsets from /proc/pid/fdinfo with
+// the previous ifstream reader and with duplicates of the descriptors
+// (pidfd_getfd), and time the rate arithmetic alone. A child process
+// opens the file n times and the benchmark samples its descriptors:
+//
+//   bench_proc /some/file 10000 20
+//
+// The open file limit (ulimit -n) must be larger than n.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <src/proc.hpp>
+#include <src/mono_time.hpp>
+
+// Previous reader, for reference: one path and one stream per file
+static bool legacy_sample(const std::string& fdinfo, file_info& info) {
+  std::ifstream in(fdinfo + '/' + std::to_string(info.fd));
+  if(!in.good()) return false;
+  std::string label;
+  while(in.good()) {
+    in >> label;
+    if(in.eof()) break;
+    if(label == "pos:") {
+      in >> std::dec >> info.offset;
+    } else if(label == "ino:") {
+      ino_t ino;
+      in >> std::dec >> ino;
+      if(ino != info.inode) return false;
+    } else {
+      int ignore;
+      in >> ignore;
+    }
+  }
+  const mono_time sample = mono_now();
+  info.speed = (info.offset - info.ooffset) / to_seconds(sample - info.stamp);
+  info.stamp = sample;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  if(argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " file nb_fds [iterations]" << std::endl;
+    return EXIT_FAILURE;
+  }
+  const int nb_fds     = std::atoi(argv[2]);
+  const int iterations = argc > 3 ? std::atoi(argv[3]) : 10;
+
+  // The child opens the descriptors, then waits to be killed
+  int ready[2];
+  if(pipe(ready) == -1) return EXIT_FAILURE;
+  const pid_t child = fork();
+  if(child == -1) return EXIT_FAILURE;
+  if(child == 0) {
+    close(ready[0]);
+    for(int i = 0; i < nb_fds; ++i) {
+      if(open(argv[1], O_RDONLY) == -1) {
+        std::cerr << "Open failed after " << i << " descriptors" << std::endl;
+        _exit(EXIT_FAILURE);
+      }
+    }
+    close(ready[1]);
+    pause();
+    _exit(EXIT_SUCCESS);
+  }
+  close(ready[1]);
+  char c;
+  const bool opened = read(ready[0], &c, 1) == 0 && kill(child, 0) == 0;
+  close(ready[0]);
+  if(!opened) return EXIT_FAILURE;
+
+  // List once, then only sample
+  proc_file_info  updater(child, false, true, 0, iterations + 2);
+  getfd_file_info getfd_updater(child, false, true, 0, iterations + 2);
+  file_list       list, getfd_list;
+  if(!updater.update_file_info(list, mono_now())) return EXIT_FAILURE;
+  if(!getfd_updater.update_file_info(getfd_list, mono_now())) return EXIT_FAILURE;
+
+  const std::string fdinfo = "/proc/" + std::to_string(child) + "/fdinfo";
+  mono_time start = mono_now();
+  size_t    legacy_samples = 0;
+  for(int i = 0; i < iterations; ++i)
+    for(auto& file : list)
+      legacy_samples += legacy_sample(fdinfo, file);
+  const double legacy_time = to_seconds(mono_now() - start) / iterations;
+
+  start = mono_now();
+  for(int i = 0; i < iterations; ++i)
+    updater.update_file_info(list, mono_now());
+  const double time = to_seconds(mono_now() - start) / iterations;
+
+  start = mono_now();
+  for(int i = 0; i < iterations; ++i)
+    getfd_updater.update_file_info(getfd_list, mono_now());
+  const double getfd_time = to_seconds(mono_now() - start) / iterations;
+
+  // The arithmetic on the samples, without reading /proc
+  start = mono_now();
+  for(int i = 0; i < iterations; ++i) {
+    const mono_time sample = mono_now();
+    for(auto& file : list) {
+      file.speed   = (file.offset - file.ooffset) / to_seconds(sample - file.stamp);
+      file.average = (file.offset - file.ooffset) / to_seconds(sample - file.start);
+      file.stamp   = sample;
+    }
+  }
+  const double rates_time = to_seconds(mono_now() - start) / iterations;
+
+  const double per_file = 1e6 / list.size();
+  std::cout << "files    " << list.size() << "\n"
+            << "ifstream " << (legacy_time * 1000) << " ms " << (legacy_time * per_file) << " us/file\n"
+            << "openat   " << (time * 1000) << " ms " << (time * per_file) << " us/file\n"
+            << "getfd    " << (getfd_time * 1000) << " ms " << (getfd_time * per_file) << " us/file ("
+            << getfd_updater.duplicates() << " duplicates)\n"
+            << "rates    " << (rates_time * 1000) << " ms " << (rates_time * per_file) << " us/file\n"
+            << "speedup  " << (legacy_time / time) << " openat, " << (legacy_time / getfd_time) << " getfd" << std::endl;
+
+  kill(child, SIGTERM);
+  waitpid(child, nullptr, 0);
+  return legacy_samples == list.size() * iterations ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,3 +1,4 @@
+#include <sstream>
 #include <gtest/gtest.h>
 #include <src/print_info.hpp>
 
@@ -64,6 +65,9 @@ TEST(Print, shorten_string) {
   for(const val_res* ptr = tests; strlen(ptr->in); ++ptr) {
     std::string res = shorten_string(ptr->in, 10);
     EXPECT_STREQ(ptr->out, res.c_str());
+    std::ostringstream os;
+    os << shortened(ptr->in, 10);
+    EXPECT_EQ(res, os.str());
   }
 }
 
@@ -0,0 +1,54 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <src/fd_trace.hpp>
+
+namespace {
+TEST(FdTrace, ring) {
+  spsc_ring<int, 4> ring;
+  int               x;
+  EXPECT_FALSE(ring.pop(x));
+  for(int i = 0; i < 4; ++i)
+    EXPECT_TRUE(ring.push(i));
+  EXPECT_FALSE(ring.push(4)); // Full
+  for(int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(ring.pop(x));
+    EXPECT_EQ(i, x);
+  }
+  EXPECT_FALSE(ring.pop(x));
+  EXPECT_TRUE(ring.push(5)); // Wraps around
+  ASSERT_TRUE(ring.pop(x));
+  EXPECT_EQ(5, x);
+}
+
+TEST(FdTrace, trace) {
+  const int fd = open("/proc/self/exe", O_RDONLY);
+  ASSERT_NE(-1, fd);
+  std::ostringstream os;
+  {
+    fd_trace trace(getpid(), fd, 1000, 0.01, os);
+    ASSERT_EQ("", trace.error());
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    lseek(fd, 12345, SEEK_SET);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    close(fd);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    trace.drain();
+    EXPECT_TRUE(trace.closed());
+  }
+  const std::string out = os.str();
+  EXPECT_NE(std::string::npos, out.find(" 0 0\n"));
+  EXPECT_NE(std::string::npos, out.find(" 12345 "));
+  EXPECT_NE(std::string::npos, out.find("# stall 0.000000"));
+  EXPECT_NE(std::string::npos, out.find("# closed"));
+}
+
+TEST(FdTrace, error) {
+  std::ostringstream os;
+  fd_trace trace(getpid(), 1000000, 1000, 0.1, os);
+  EXPECT_NE("", trace.error());
+}
+}
@@ -0,0 +1,35 @@
+#include <sys/stat.h>
+#include <gtest/gtest.h>
+#include <src/file_filter.hpp>
+
+namespace {
+TEST(FileFilter, patterns) {
+  const file_filter filter({ "/data/*", "/scratch/*" }, { "*.log" }, {}, 0);
+  ASSERT_TRUE(filter.error().empty());
+  EXPECT_TRUE(filter.accept("/data/reads.fa", 0, 0));
+  EXPECT_TRUE(filter.accept("/scratch/a/b/c.bam", 0, 0));
+  EXPECT_FALSE(filter.accept("/data/run.log", 0, 0));
+  EXPECT_FALSE(filter.accept("/usr/lib/libc.so.6", 0, 0));
+
+  const file_filter regex({}, { "\\.so(\\.[0-9]+)*$" }, {}, 0, true);
+  ASSERT_TRUE(regex.error().empty());
+  EXPECT_TRUE(regex.accept("/data/reads.fa", 0, 0));
+  EXPECT_FALSE(regex.accept("/usr/lib/libc.so.6", 0, 0));
+
+  const file_filter invalid({ "(" }, {}, {}, 0, true);
+  EXPECT_FALSE(invalid.error().empty());
+}
+
+TEST(FileFilter, mount_size) {
+  struct stat stat_buf;
+  ASSERT_EQ(0, stat(".", &stat_buf));
+  const file_filter filter({}, {}, { "." }, 1024);
+  ASSERT_TRUE(filter.error().empty());
+  EXPECT_TRUE(filter.accept("file", stat_buf.st_dev, 1024));
+  EXPECT_FALSE(filter.accept("file", stat_buf.st_dev, 1023));
+  EXPECT_FALSE(filter.accept("file", stat_buf.st_dev + 1, 1 << 20));
+
+  const file_filter invalid({}, {}, { "/does/not/exist" }, 0);
+  EXPECT_FALSE(invalid.error().empty());
+}
+} // namespace
@@ -0,0 +1,53 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <src/inotify_watches.hpp>
+
+namespace {
+TEST(InotifyWatches, changed) {
+  const char* path = "test_inotify";
+  { std::ofstream out(path); out << "Hello the world"; }
+  const int fd = open(path, O_RDONLY);
+  ASSERT_LE(0, fd);
+
+  inotify_watches watches;
+  if(!watches.good()) {
+    unlink(path);
+    close(fd);
+    return; // Not supported
+  }
+  const std::string fd_path = "/proc/self/fd/" + std::to_string(fd);
+  const int wd = watches.add(fd_path.c_str());
+  ASSERT_NE(-1, wd);
+  EXPECT_EQ(wd, watches.add(path)); // Same file, same watch
+
+  // A new watch is changed until the next poll
+  const uint64_t p1 = watches.poll();
+  EXPECT_TRUE(watches.changed(wd, p1 - 1));
+  EXPECT_FALSE(watches.changed(wd, p1));
+
+  // No access
+  const uint64_t p2 = watches.poll();
+  EXPECT_FALSE(watches.changed(wd, p1));
+
+  // Read
+  char buf[5];
+  ASSERT_EQ((ssize_t)sizeof(buf), read(fd, buf, sizeof(buf)));
+  const uint64_t p3 = watches.poll();
+  EXPECT_TRUE(watches.changed(wd, p2));
+  EXPECT_FALSE(watches.changed(wd, p3));
+
+  // Unknown watches are always changed
+  EXPECT_TRUE(watches.changed(wd + 1, p3));
+
+  // Removed with the last reference
+  watches.release(wd);
+  EXPECT_FALSE(watches.changed(wd, p3));
+  watches.release(wd);
+  EXPECT_TRUE(watches.changed(wd, p3));
+
+  close(fd);
+  unlink(path);
+}
+} // namespace
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include <src/lsof.hpp>
-#include <src/timespec.hpp>
+#include <src/mono_time.hpp>
+#include <src/file_filter.hpp>
 
 namespace {
 TEST(LSOF, find_file_in_list) {
@@ -16,34 +17,85 @@ TEST(LSOF, find_file_in_list) {
   list.push_back(f);
 
   EXPECT_EQ((size_t)2, list.size());
-  auto s1 = find_file_in_list(list, 0, 314);
+  auto s1 = list.find(0, 314);
   ASSERT_NE(list.end(), s1);
   EXPECT_EQ(0, s1->fd);
   EXPECT_EQ((ino_t)314, s1->inode);
 
-  auto s2 = find_file_in_list(list, 5, 271);
+  auto s2 = list.find(5, 271);
   ASSERT_NE(list.end(), s2);
   EXPECT_EQ(5, s2->fd);
   EXPECT_EQ((ino_t)271, s2->inode);
 
-  auto s3 = find_file_in_list(list, 5, 314);
+  auto s3 = list.find(5, 314);
   ASSERT_EQ(list.end(), s3);
 }
 
+TEST(LSOF, archive_closed) {
+  file_list list;
+  file_info f = file_info();
+  for(int fd = 0; fd < 5; ++fd) {
+    f.fd      = fd;
+    f.inode   = 100 + fd;
+    f.offset  = 1000;
+    f.ooffset = 500; // 500 bytes in 10 seconds
+    f.start   = mono_time(std::chrono::seconds(1));
+    f.stamp   = mono_time(std::chrono::seconds(11));
+    f.updated = fd % 2 == 0; // 1 and 3 closed
+    list.push_back(f);
+  }
+
+  EXPECT_EQ((size_t)0, list.archive_closed(2));
+  EXPECT_EQ((size_t)1, list.archive_closed(1));
+  ASSERT_EQ((size_t)4, list.size());
+  EXPECT_EQ(list.end(), list.find(1, 101)); // The oldest closed
+  ASSERT_NE(list.end(), list.find(3, 103));
+  ASSERT_NE(list.end(), list.find(4, 104));
+  EXPECT_EQ(4, list.find(4, 104)->fd);
+
+  EXPECT_EQ((size_t)1, list.archive.files);
+  EXPECT_EQ((off_t)1000, list.archive.bytes);
+  EXPECT_EQ((size_t)1, list.archive_closed(0));
+  EXPECT_EQ((size_t)2, list.archive.files);
+  EXPECT_EQ((off_t)2000, list.archive.bytes);
+  EXPECT_EQ((off_t)1000, list.archive.moved);
+  EXPECT_DOUBLE_EQ(20.0, list.archive.seconds);
+  EXPECT_DOUBLE_EQ(50.0, list.archive.rate());
+}
+
 struct lsof_file_info_mock : public lsof_file_info {
-  lsof_file_info_mock() : lsof_file_info(0) { }
+  explicit lsof_file_info_mock(std::shared_ptr<const file_filter> filter = nullptr)
+    : lsof_file_info(0, false, nullptr, filter)
+  { }
 
   bool parse_line(std::string& line, file_info& f, bool& failed) {
-    return lsof_file_info::parse_line(line, f, failed);
+    return lsof_parser::parse_line(line.data(), line.data() + line.size(), f, failed);
   }
-  bool update_file_info(std::istream& is, file_list& list, const timespec& stamp, bool& need_updated_name) {
-    return lsof_file_info::update_file_info(is, list, stamp, need_updated_name);
+  bool update_file_info(std::istream& is, file_list& list, const mono_time& stamp, bool& need_updated_name) {
+    lsof_section& section = parse(is);
+    section.stamp         = stamp; // As if output by lsof at stamp
+    return lsof_file_info::update_file_info(section, list, stamp, need_updated_name);
   }
-  bool update_file_names(file_list& list) {
-    return lsof_file_info::update_file_names(list);
+  bool update_file_names(file_list& list, const mono_time& stamp) {
+    return lsof_file_info::update_file_names(list, stamp);
   }
   bool update_file_names(std::istream& is, file_list& list) {
-    return lsof_file_info::update_file_names(is, list);
+    return lsof_file_info::update_file_names(parse(is), list);
+  }
+
+  // Parse the content of is as the output of lsof for the pid of its
+  // first p line, or for pid 0 if it starts with the files
+  lsof_sections sections;
+  lsof_section& parse(std::istream& is) {
+    std::string content((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    sections.clear();
+    lsof_parser parser(sections);
+    const pid_t pid = content.empty() || content[0] != 'p' ? 0 : std::atoi(content.c_str() + 1);
+    if(pid == 0)
+      parser.feed("p0\0\n", 4);
+    parser.feed(content.data(), content.size());
+    parser.finish();
+    return sections[pid];
   }
 
 };
@@ -104,18 +156,18 @@ TEST(LSOF, update_file_info) {
   for(const char** ptr = lines; *ptr; ++ptr)
     lsof_stream << std::string(*ptr, (const char*)memchr(*ptr, '\n', 1024) - *ptr + 1);
 
-  timespec stamp = { 5, 2345 };
+  const mono_time stamp(std::chrono::seconds(5) + std::chrono::nanoseconds(2345));
   file_list list;
   bool need_updated_name;
   bool res = updater.update_file_info(lsof_stream, list, stamp, need_updated_name);
   EXPECT_TRUE(res);
   EXPECT_TRUE(need_updated_name);
   ASSERT_EQ((size_t)2, list.size());
-  EXPECT_TRUE(list[0].updated);
-  EXPECT_EQ(stamp, list[0].stamp);
-  EXPECT_TRUE(list[1].updated);
-  EXPECT_EQ(stamp, list[1].stamp);
-  EXPECT_EQ((off_t)58, list[1].offset);
+  EXPECT_TRUE(list.list[0].updated);
+  EXPECT_EQ(stamp, list.list[0].stamp);
+  EXPECT_TRUE(list.list[1].updated);
+  EXPECT_EQ(stamp, list.list[1].stamp);
+  EXPECT_EQ((off_t)58, list.list[1].offset);
 
   std::stringstream lsof_stream2;
   const char* lines2[] = {
@@ -123,20 +175,20 @@ TEST(LSOF, update_file_info) {
     "f11\0ar\0o0\0i1\0\n",
     0
   };
-  timespec new_stamp = stamp + 5;
+  const mono_time new_stamp = stamp + std::chrono::seconds(5);
   for(const char** ptr = lines2; *ptr; ++ptr)
     lsof_stream2 << std::string(*ptr, (const char*)memchr(*ptr, '\n', 1024) - *ptr + 1);
   res = updater.update_file_info(lsof_stream2, list, new_stamp, need_updated_name);
   EXPECT_TRUE(res);
   EXPECT_TRUE(need_updated_name);
   ASSERT_EQ((size_t)3, list.size());
-  EXPECT_FALSE(list[0].updated);
-  EXPECT_EQ(stamp, list[0].stamp);
-  EXPECT_TRUE(list[1].updated);
-  EXPECT_EQ(new_stamp, list[1].stamp);
-  EXPECT_EQ((off_t)0x435678, list[1].offset);
-  EXPECT_TRUE(list[2].updated);
-  EXPECT_EQ(new_stamp, list[2].stamp);
+  EXPECT_FALSE(list.list[0].updated);
+  EXPECT_EQ(stamp, list.list[0].stamp);
+  EXPECT_TRUE(list.list[1].updated);
+  EXPECT_EQ(new_stamp, list.list[1].stamp);
+  EXPECT_EQ((off_t)0x435678, list.list[1].offset);
+  EXPECT_TRUE(list.list[2].updated);
+  EXPECT_EQ(new_stamp, list.list[2].stamp);
 
   std::stringstream lsof_stream3;
   const char* lines3[] = {
@@ -149,10 +201,109 @@ TEST(LSOF, update_file_info) {
   res = updater.update_file_names(lsof_stream3, list);
   EXPECT_TRUE(res);
   ASSERT_EQ((size_t)3, list.size());
-  EXPECT_STREQ("/path/to/nname10", list[1].name.c_str());
-  EXPECT_EQ((off_t)1024, list[1].size);
-  EXPECT_STREQ("relative (on /raid)", list[0].name.c_str());
-  EXPECT_EQ((off_t)123456, list[0].size);
-  EXPECT_TRUE(list[2].name.empty());
+  EXPECT_STREQ("/path/to/nname10", list.list[1].name.c_str());
+  EXPECT_EQ((off_t)1024, list.list[1].size);
+  EXPECT_STREQ("relative (on /raid)", list.list[0].name.c_str());
+  EXPECT_EQ((off_t)123456, list.list[0].size);
+  EXPECT_TRUE(list.list[2].name.empty());
+}
+
+TEST(LSOF, filter) {
+  auto filter = std::make_shared<file_filter>(std::vector<const char*>{ "/data/*" }, std::vector<const char*>(),
+                                              std::vector<const char*>(), 0);
+  lsof_file_info_mock updater(filter);
+  const char offsets[] = "f2\0ar\0o0x2345\0i9876\0\nf10\0ar\0o0t58\0i452\0\n";
+  const char names[]   = "f2\0ar\0s10\0i9876\0n/usr/lib/libc.so\0\nf10\0ar\0s100\0i452\0n/data/reads\0\n";
+
+  file_list list;
+  bool      need_updated_name;
+  std::stringstream offsets1(std::string(offsets, sizeof(offsets) - 1));
+  ASSERT_TRUE(updater.update_file_info(offsets1, list, mono_now(), need_updated_name));
+  EXPECT_TRUE(need_updated_name);
+  std::stringstream names1(std::string(names, sizeof(names) - 1));
+  ASSERT_TRUE(updater.update_file_names(names1, list));
+  ASSERT_EQ((size_t)1, list.size());
+  EXPECT_EQ("/data/reads", list.list[0].name);
+  EXPECT_EQ(list.begin(), list.find(10, 452));
+
+  // The filtered file is not added again
+  std::stringstream offsets2(std::string(offsets, sizeof(offsets) - 1));
+  ASSERT_TRUE(updater.update_file_info(offsets2, list, mono_now(), need_updated_name));
+  EXPECT_FALSE(need_updated_name);
+  EXPECT_EQ((size_t)1, list.size());
+  EXPECT_EQ((size_t)0, updater.stats().opened);
+}
+
+TEST(LSOF, unnamed) {
+  lsof_file_info_mock updater;
+  const char offsets1[] = "f2\0ar\0o0x2345\0i9876\0\nf10\0ar\0o0t58\0i452\0\n";
+  const char offsets2[] = "f10\0ar\0o0t60\0i452\0\n";
+
+  file_list list;
+  bool      need_updated_name;
+  std::stringstream stream1(std::string(offsets1, sizeof(offsets1) - 1));
+  ASSERT_TRUE(updater.update_file_info(stream1, list, mono_now(), need_updated_name));
+  EXPECT_TRUE(need_updated_name);
+  EXPECT_EQ((size_t)0, updater.stats().unnamed);
+
+  // fd 2 closed before its name was looked up
+  std::stringstream stream2(std::string(offsets2, sizeof(offsets2) - 1));
+  ASSERT_TRUE(updater.update_file_info(stream2, list, mono_now(), need_updated_name));
+  EXPECT_EQ((size_t)1, updater.stats().closed);
+  EXPECT_EQ((size_t)1, updater.stats().unnamed);
+}
+
+TEST(LSOF, parse_sections) {
+  const char lines[] =
+    "lsof: WARNING: ignored\n"
+    "p31415\0\n"
+    "f2\0ar\0tREG\0o0x2345\0i9876\0\n"
+    "p271\0\n"
+    "fNOFD\0\n"
+    "p314\0\n"
+    "f10\0ar\0tREG\0o0t58\0i452\0\n"
+    "f11\0ar\0tREG\0o0\0i1\0\n";
+  lsof_sections sections;
+  // Small buffer to split lines across reads
+  lsof_parser   parser(sections, 8);
+  for(size_t i = 0; i < sizeof(lines) - 1; i += 5)
+    parser.feed(lines + i, std::min((size_t)5, sizeof(lines) - 1 - i));
+  parser.finish();
+  ASSERT_EQ((size_t)3, sections.size());
+  EXPECT_FALSE(sections[31415].failed);
+  ASSERT_EQ((size_t)1, sections[31415].files.size());
+  EXPECT_EQ((off_t)0x2345, sections[31415].files[0].offset);
+  EXPECT_TRUE(sections[271].failed);
+  ASSERT_EQ((size_t)2, sections[314].files.size());
+  EXPECT_EQ(10, sections[314].files[0].fd);
+  EXPECT_EQ((off_t)58, sections[314].files[0].offset);
+  EXPECT_EQ((ino_t)1, sections[314].files[1].inode);
+  // Sections are stamped in the order they are read
+  EXPECT_NE(mono_time(), sections[31415].stamp);
+  EXPECT_FALSE(sections[314].stamp < sections[31415].stamp);
+}
+struct lsof_batch_mock : public lsof_batch {
+  using lsof_batch::lsof_batch;
+  lsof_sections sections;
+  bool run(const char* cmd[], pid_t& start) { return lsof_batch::run(cmd, sections, start); }
+};
+
+TEST(LSOF, per_pid_resume) {
+  // "sleep pid" instead of lsof: 0 is done at once, 100 and 200 time out
+  lsof_batch_mock batch(1, 0.2);
+  batch.add(0);
+  batch.add(100);
+  batch.add(200);
+  const char* cmd[] = { "/usr/bin/env", "sleep", nullptr, nullptr };
+  pid_t       start = 0;
+  EXPECT_TRUE(batch.run(cmd, start));
+  EXPECT_EQ(200, start); // Not launched
+  EXPECT_TRUE(batch.run(cmd, start));
+  EXPECT_EQ(0, start); // Wrapped around
+  batch.remove(0); // Both time out, in turn
+  EXPECT_TRUE(batch.run(cmd, start));
+  EXPECT_EQ(200, start);
+  EXPECT_TRUE(batch.run(cmd, start));
+  EXPECT_EQ(100, start);
 }
 } // namespace
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <src/mono_time.hpp>
+
+namespace {
+using std::chrono::seconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+TEST(MonoTime, deltas) {
+  // The nanosecond part underflows: 5.1s - 4.9s
+  const mono_time t1(seconds(4) + nanoseconds(900000000));
+  const mono_time t2(seconds(5) + nanoseconds(100000000));
+  EXPECT_EQ(nanoseconds(200000000), t2 - t1);
+  EXPECT_EQ(nanoseconds(-200000000), t1 - t2);
+  EXPECT_DOUBLE_EQ(0.2, to_seconds(t2 - t1));
+  EXPECT_DOUBLE_EQ(-0.2, to_seconds(t1 - t2));
+
+  // Sub-microsecond differences are exact
+  const mono_time t3 = t1 + nanoseconds(1);
+  EXPECT_EQ(nanoseconds(1), t3 - t1);
+  EXPECT_TRUE(t1 < t3);
+  EXPECT_DOUBLE_EQ(1e-9, to_seconds(t3 - t1));
+}
+
+TEST(MonoTime, conversions) {
+  EXPECT_EQ(milliseconds(1500), from_seconds(1.5));
+  EXPECT_EQ(nanoseconds(250), from_seconds(250e-9));
+
+  const timespec ts = to_timespec(mono_time(seconds(7) + nanoseconds(123456789)));
+  EXPECT_EQ((time_t)7, ts.tv_sec);
+  EXPECT_EQ(123456789, ts.tv_nsec);
+}
+
+TEST(MonoTime, timeout_ms) {
+  const mono_time now(seconds(10));
+  EXPECT_EQ(0, timeout_ms(now, now));
+  EXPECT_EQ(0, timeout_ms(now, now - nanoseconds(1)));
+  EXPECT_EQ(1, timeout_ms(now, now + nanoseconds(1))); // Rounded up
+  EXPECT_EQ(1, timeout_ms(now, now + milliseconds(1)));
+  EXPECT_EQ(2, timeout_ms(now, now + milliseconds(1) + nanoseconds(1)));
+  EXPECT_EQ(1500, timeout_ms(now, now + from_seconds(1.5)));
+}
+
+TEST(MonoTime, now) {
+  const mono_time t1 = mono_now();
+  const mono_time t2 = mono_now();
+  EXPECT_FALSE(t2 < t1);
+
+  // Same clock as CLOCK_MONOTONIC
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const mono_time t3 = mono_now();
+  const mono_time t4(seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec));
+  EXPECT_FALSE(t3 < t4);
+  EXPECT_LT(to_seconds(t3 - t4), 1.0);
+}
+} // namespace
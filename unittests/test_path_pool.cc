@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include <src/path_pool.hpp>
+
+namespace {
+TEST(PathPool, share) {
+  path_pool&   pool = path_pool::instance();
+  const size_t size = pool.size();
+  {
+    const std::string   path("/data/reference.fa");
+    const interned_path a(path);
+    const interned_path b("/data/reference.fa");
+    const interned_path c("/data/reads.fa");
+    EXPECT_EQ(size + 2, pool.size());
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(&a.str(), &b.str()); // Same string
+    EXPECT_NE(a, c);
+    EXPECT_TRUE(a == path);
+    EXPECT_STREQ("/data/reads.fa", c.c_str());
+
+    interned_path d = a; // Copy
+    EXPECT_EQ(&a.str(), &d.str());
+    EXPECT_EQ(size + 2, pool.size());
+  }
+  // Freed with their last reference
+  EXPECT_EQ(size, pool.size());
+}
+
+TEST(PathPool, empty) {
+  const size_t        size = path_pool::instance().size();
+  const interned_path a;
+  const interned_path b("");
+  EXPECT_TRUE(a.empty());
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(a, b);
+  EXPECT_STREQ("", a.c_str());
+  EXPECT_EQ(size, path_pool::instance().size());
+}
+}
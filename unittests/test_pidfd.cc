@@ -0,0 +1,39 @@
+#include <sys/wait.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+#include <src/pidfd.hpp>
+
+namespace {
+TEST(PIDFD, exited) {
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: exit when the parent closes the pipe
+    char c;
+    close(pipefd[1]);
+    while(read(pipefd[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(pipefd[0]);
+
+  pid_fd pidfd(pid);
+  if(!pidfd.good()) { // Kernel without pidfd
+    close(pipefd[1]);
+    waitpid(pid, nullptr, 0);
+    return;
+  }
+  EXPECT_FALSE(pidfd.exited());
+  EXPECT_FALSE(pidfd.wait(10));
+  close(pipefd[1]);
+  EXPECT_TRUE(pidfd.wait(5000));
+  EXPECT_TRUE(pidfd.exited()); // Zombie: exited but not reaped yet
+  waitpid(pid, nullptr, 0);
+}
+
+TEST(PIDFD, invalid) {
+  pid_fd pidfd(0);
+  EXPECT_FALSE(pidfd.good());
+  EXPECT_FALSE(pidfd.exited());
+}
+} // namespace
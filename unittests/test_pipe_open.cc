@@ -1,6 +1,8 @@
 #include <gtest/gtest.h>
 #include <src/pipe_open.hpp>
 #include <stdexcept>
+#include <sys/wait.h>
+#include <errno.h>
 
 TEST(PipeOpen, echo) {
   const char* text = "Hello there";
@@ -65,3 +67,27 @@ TEST(PipeOpen, fail) {
   EXPECT_TRUE(line.empty());
   EXPECT_FALSE(no_pipe_no_check.good());
 }
+
+TEST(PipeOpen, fail_status) {
+  const char* no_cmd[] = { "qwertyuiopasdfghjklzxcvbnm", 0 };
+  pipe_open no_pipe_no_check(no_cmd, false);
+  std::pair<int, int> res = no_pipe_no_check.status();
+  ASSERT_EQ(0, res.first);
+  ASSERT_TRUE(WIFEXITED(res.second));
+  ASSERT_EQ(127, WEXITSTATUS(res.second));
+}
+
+TEST(PipeOpen, spawn_command) {
+  const char* false_cmd[] = { "false", 0 };
+  pid_t pid = spawn_command(false_cmd);
+  ASSERT_LT(0, pid);
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  ASSERT_TRUE(WIFEXITED(status));
+  ASSERT_EQ(1, WEXITSTATUS(status));
+
+  const char* no_cmd[] = { "qwertyuiopasdfghjklzxcvbnm", 0 };
+  errno = 0;
+  EXPECT_EQ(-1, spawn_command(no_cmd));
+  EXPECT_EQ(ENOENT, errno);
+}
@@ -1,3 +1,6 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <fstream>
@@ -9,11 +12,12 @@
 namespace {
 struct proc_file_info_mock : public proc_file_info {
   proc_file_info_mock() : proc_file_info(0) { }
-  bool update_file_info(file_list& list, const timespec& stamp) {
+  bool update_file_info(file_list& list, const mono_time& stamp) {
     return proc_file_info::update_file_info(list, stamp);
   }
-  bool update_file_info(file_info& info, const timespec& stamp, std::istream& in, const bool is_new) {
-    return proc_file_info::update_file_info(info, stamp, in, is_new);
+  bool update_file_info(file_info& info, const mono_time& stamp, std::istream& in, const bool is_new) {
+    const std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return proc_file_info::parse_fdinfo(info, content.c_str(), is_new);
   }
 };
 
@@ -26,7 +30,7 @@ struct unlink_file {
 
 TEST(PROC, update_file_info_internal) {
   file_info info;
-  timespec stamp = {5, 2345 };
+  const mono_time stamp(std::chrono::seconds(5) + std::chrono::nanoseconds(2345));
   proc_file_info_mock updater;
 
   {
@@ -105,8 +109,8 @@ TEST(PROC, update_file_info_external) {
   auto s = read(pipefd2[0], &buf, 1); // Wait for child to close its end -> ready to get fd information
   ASSERT_EQ(0, s);
 
-  std::vector<file_info> info_files;
-  timespec stamp = { 4, 5432 };
+  file_list info_files;
+  const mono_time stamp(std::chrono::seconds(4) + std::chrono::nanoseconds(5432));
   proc_file_info updater(pid);
   ASSERT_TRUE(updater.update_file_info(info_files, stamp));
   ASSERT_EQ((size_t)2, info_files.size());
@@ -115,22 +119,22 @@ TEST(PROC, update_file_info_external) {
   std::string p;
   char* pwd(get_current_dir_name());
   ASSERT_EQ(0, stat(in_file.path.c_str(), &stat_buf));
-  EXPECT_LT(-1, info_files[0].fd);
-  EXPECT_EQ(stat_buf.st_ino, info_files[0].inode);
+  EXPECT_LT(-1, info_files.list[0].fd);
+  EXPECT_EQ(stat_buf.st_ino, info_files.list[0].inode);
   p = std::string(pwd) + "/" + in_file.path;
-  EXPECT_EQ(p, info_files[0].name);
-  EXPECT_LT(line.size(), (size_t)info_files[0].offset);
-  EXPECT_FALSE(info_files[0].writable);
-  EXPECT_TRUE(info_files[0].updated);
+  EXPECT_EQ(p, info_files.list[0].name);
+  EXPECT_LT(line.size(), (size_t)info_files.list[0].offset);
+  EXPECT_FALSE(info_files.list[0].writable);
+  EXPECT_TRUE(info_files.list[0].updated);
 
   ASSERT_EQ(0, stat(out_file.path.c_str(), &stat_buf));
-  EXPECT_LT(-1, info_files[1].fd);
-  EXPECT_EQ(stat_buf.st_ino, info_files[1].inode);
+  EXPECT_LT(-1, info_files.list[1].fd);
+  EXPECT_EQ(stat_buf.st_ino, info_files.list[1].inode);
   p = std::string(pwd) + "/" + out_file.path;
-  EXPECT_EQ(p, info_files[1].name);
-  EXPECT_EQ(2 * line.size(), (size_t)info_files[1].offset);
-  EXPECT_TRUE(info_files[1].writable);
-  EXPECT_TRUE(info_files[1].updated);
+  EXPECT_EQ(p, info_files.list[1].name);
+  EXPECT_EQ(2 * line.size(), (size_t)info_files.list[1].offset);
+  EXPECT_TRUE(info_files.list[1].writable);
+  EXPECT_TRUE(info_files.list[1].updated);
 
   free(pwd);
   close(pipefd1[1]); // Signal child to exit
@@ -138,4 +142,426 @@ TEST(PROC, update_file_info_external) {
   wait(&status);
   //  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
 }
+
+TEST(PROC, fd_budget) {
+  const unlink_file tmp_file("test_budget");
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  std::vector<int> fds;
+  for(int i = 0; i < 20; ++i) {
+    fds.push_back(open(tmp_file.path.c_str(), O_RDONLY));
+    ASSERT_LE(0, fds.back());
+  }
+
+  const size_t budget = 6;
+  proc_file_info updater(getpid(), false, false, budget);
+  file_list      list;
+  size_t         updates = 0;
+  for(bool all_sampled = false; !all_sampled; ++updates) {
+    ASSERT_GT((size_t)20, updates);
+    const mono_time stamp = mono_now();
+    ASSERT_TRUE(updater.update_file_info(list, stamp));
+    ASSERT_LT(budget, list.size());
+    size_t nb = 0;
+    all_sampled = true;
+    for(const auto& file : list) {
+      nb += !(file.stamp < stamp);
+      all_sampled = all_sampled && file.stamp != mono_time();
+    }
+    EXPECT_GE(budget, nb);
+  }
+  // Every file sampled within a round
+  EXPECT_GE((2 * list.size() + budget - 1) / budget, updates);
+
+  // A closed descriptor is not updated anymore
+  const int fd = fds.back();
+  close(fd);
+  fds.pop_back();
+  for(size_t i = 0; i < updates; ++i)
+    ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  auto closed = list.find(fd, list.list[list.fds[fd]].inode);
+  ASSERT_NE(list.end(), closed);
+  EXPECT_FALSE(closed->updated);
+
+  // A new descriptor is found by the listing spread over the updates
+  const unlink_file new_file("test_budget_new");
+  { std::ofstream out(new_file.path.c_str()); out << "Hello the world"; }
+  struct stat stat_buf;
+  ASSERT_EQ(0, stat(new_file.path.c_str(), &stat_buf));
+  fds.push_back(open(new_file.path.c_str(), O_RDONLY));
+  ASSERT_LE(0, fds.back());
+  for(size_t i = 0; i < 2 * updates && list.find(fds.back(), stat_buf.st_ino) == list.end(); ++i)
+    ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  const auto found = list.find(fds.back(), stat_buf.st_ino);
+  ASSERT_NE(list.end(), found);
+  EXPECT_TRUE(found->updated);
+
+  for(int f : fds)
+    close(f);
+}
+
+TEST(PROC, list_every) {
+  const unlink_file tmp_file1("test_list1");
+  const unlink_file tmp_file2("test_list2");
+  { std::ofstream out(tmp_file1.path.c_str()); out << "Hello the world"; }
+  { std::ofstream out(tmp_file2.path.c_str()); out << "Hello the world"; }
+  const int fd1 = open(tmp_file1.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, fd1);
+
+  proc_file_info updater(getpid(), false, false, 0, 1000);
+  file_list      list;
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_TRUE(updater.stats().listed);
+  ASSERT_NE(list.end(), list.find(fd1, list.list[list.fds[fd1]].inode));
+  const size_t nb_files = list.size();
+
+  // Not listed again: the new file is not found
+  const int fd2 = open(tmp_file2.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, fd2);
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_FALSE(updater.stats().listed);
+  EXPECT_EQ(nb_files, list.size());
+
+  // A file closed: listed again and the new file found
+  close(fd1);
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_TRUE(updater.stats().listed);
+  EXPECT_EQ((size_t)1, updater.stats().closed);
+  EXPECT_EQ((size_t)1, updater.stats().opened);
+  EXPECT_EQ(nb_files + 1, list.size());
+  EXPECT_TRUE(list.list.back().updated);
+  EXPECT_EQ(fd2, list.list.back().fd);
+  EXPECT_NE(mono_time(), list.list.back().stamp);
+
+  close(fd2);
+}
+
+TEST(PROC, inotify) {
+  const unlink_file tmp_file("test_inotify");
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  const int fd = open(tmp_file.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, fd);
+
+  auto watches = std::make_shared<inotify_watches>();
+  if(!watches->good()) return; // Not supported
+  proc_file_info updater(getpid(), false, false, 0, 1000, watches);
+  file_list      list;
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  auto file = list.find(fd, list.list[list.fds[fd]].inode);
+  ASSERT_NE(list.end(), file);
+  EXPECT_NE(-1, file->wd);
+
+  // Idle: skipped once the watch is settled
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  const mono_time stamp = mono_now();
+  ASSERT_TRUE(updater.update_file_info(list, stamp));
+  EXPECT_LE((size_t)1, updater.stats().skipped);
+  EXPECT_TRUE(list.list[list.fds[fd]].updated);
+  EXPECT_FALSE(list.list[list.fds[fd]].stamp < stamp);
+
+  // Read: sampled again
+  char buf[5];
+  ASSERT_EQ((ssize_t)sizeof(buf), read(fd, buf, sizeof(buf)));
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_EQ((off_t)sizeof(buf), list.list[list.fds[fd]].offset);
+  EXPECT_LT(0, list.list[list.fds[fd]].speed);
+
+  close(fd);
+}
+
+TEST(PROC, classify) {
+  const unlink_file tmp_file("test_classify");
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  int fd = open(tmp_file.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, fd);
+
+  proc_file_info updater(getpid(), false, false, 0, 1000);
+  file_list      list;
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_EQ(list.end(), list.find(pipefd[0], 0)); // Pipes are skipped
+  EXPECT_EQ(list.fds.end(), list.fds.find(pipefd[0]));
+  ASSERT_NE(list.fds.end(), list.fds.find(fd));
+  const ino_t inode = list.list[list.fds[fd]].inode;
+
+  // Same path and same descriptor, but a new file: found by its
+  // inode. Keep the old file open so its inode is not reused.
+  const int keep = dup(fd);
+  close(fd);
+  unlink(tmp_file.path.c_str());
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  ASSERT_EQ(fd, open(tmp_file.path.c_str(), O_RDONLY));
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  ASSERT_NE(list.end(), list.find(fd, inode));
+  EXPECT_FALSE(list.find(fd, inode)->updated);
+  const file_info& file = list.list[list.fds[fd]];
+  EXPECT_NE(inode, file.inode);
+  EXPECT_TRUE(file.updated);
+  EXPECT_NE(std::string::npos, file.name.str().find(tmp_file.path));
+
+  // A rejected path (a directory) replaced by a regular file: kept
+  // rejected until the fd table grows
+  const std::string dir_path = tmp_file.path + "_dir";
+  ASSERT_EQ(0, mkdir(dir_path.c_str(), 0700));
+  const int dir_fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY);
+  ASSERT_LE(0, dir_fd);
+  proc_file_info lister(getpid());
+  file_list      listed;
+  ASSERT_TRUE(lister.update_file_info(listed, mono_now()));
+  EXPECT_EQ(listed.fds.end(), listed.fds.find(dir_fd));
+  close(dir_fd);
+  rmdir(dir_path.c_str());
+  { std::ofstream out(dir_path.c_str()); out << "Hello the world"; }
+  const unlink_file replaced(dir_path.c_str());
+  ASSERT_EQ(dir_fd, open(dir_path.c_str(), O_RDONLY));
+  ASSERT_TRUE(lister.update_file_info(listed, mono_now()));
+  EXPECT_EQ(listed.fds.end(), listed.fds.find(dir_fd));
+  // Grow the fd table with a descriptor just past its size
+  int fdsize = 0;
+  {
+    std::ifstream status("/proc/self/status");
+    for(std::string line; std::getline(status, line); )
+      if(!line.compare(0, 7, "FDSize:")) fdsize = std::atoi(line.c_str() + 7);
+  }
+  ASSERT_LT(0, fdsize);
+  const int high = dup2(dir_fd, fdsize);
+  ASSERT_EQ(fdsize, high);
+  ASSERT_TRUE(lister.update_file_info(listed, mono_now()));
+  ASSERT_NE(listed.fds.end(), listed.fds.find(dir_fd));
+  EXPECT_TRUE(listed.list[listed.fds[dir_fd]].updated);
+
+  close(high);
+  close(dir_fd);
+  close(fd);
+  close(keep);
+  close(pipefd[0]);
+  close(pipefd[1]);
+}
+
+TEST(PROC, getfd) {
+  const unlink_file tmp_file("test_getfd");
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  int to_child[2], from_child[2];
+  ASSERT_EQ(0, pipe(to_child));
+  ASSERT_EQ(0, pipe(from_child));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: seek to 5, then 10 and close the file when asked
+    char c = 'a';
+    close(to_child[1]);
+    close(from_child[0]);
+    const int fd = open(tmp_file.path.c_str(), O_RDONLY);
+    lseek(fd, 5, SEEK_SET);
+    if(write(from_child[1], &c, 1) != 1 || read(to_child[0], &c, 1) != 1) _exit(1);
+    lseek(fd, 10, SEEK_SET);
+    if(write(from_child[1], &c, 1) != 1 || read(to_child[0], &c, 1) != 1) _exit(1);
+    close(fd);
+    if(write(from_child[1], &c, 1) != 1) _exit(1);
+    while(read(to_child[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(to_child[0]);
+  close(from_child[1]);
+  char c = 'a';
+  ASSERT_EQ(1, read(from_child[0], &c, 1));
+
+  // Read through a duplicate if allowed, fdinfo otherwise
+  getfd_file_info updater(pid, false, false, 0, 1000);
+  file_list       list;
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  auto file = std::find_if(list.begin(), list.end(), [&](const file_info& f) {
+      const std::string& name = f.name;
+      return name.size() > tmp_file.path.size() && !name.compare(name.size() - tmp_file.path.size(), std::string::npos, tmp_file.path);
+    });
+  ASSERT_NE(list.end(), file);
+  const int fd = file->fd;
+  EXPECT_EQ((off_t)5, file->offset);
+  EXPECT_EQ((off_t)15, file->size);
+  EXPECT_FALSE(file->writable);
+  const size_t duplicates = updater.duplicates();
+
+  ASSERT_EQ(1, write(to_child[1], &c, 1));
+  ASSERT_EQ(1, read(from_child[0], &c, 1));
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  file = list.begin() + list.fds[fd];
+  EXPECT_TRUE(file->updated);
+  EXPECT_EQ((off_t)10, file->offset);
+  EXPECT_EQ(duplicates, updater.duplicates());
+
+  // Closed: found by the sample, and the duplicate dropped
+  ASSERT_EQ(1, write(to_child[1], &c, 1));
+  ASSERT_EQ(1, read(from_child[0], &c, 1));
+  ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  EXPECT_FALSE(list.list[list.fds[fd]].updated);
+  EXPECT_EQ((size_t)1, updater.stats().closed);
+  if(duplicates > 0) {
+    EXPECT_EQ(duplicates - 1, updater.duplicates());
+  }
+
+  close(to_child[1]);
+  close(from_child[0]);
+  waitpid(pid, nullptr, 0);
+}
+
+TEST(PROC, getfd_inotify) {
+  const unlink_file tmp_file("test_getfd_inotify");
+  { std::ofstream out(tmp_file.path.c_str()); out << "Hello the world"; }
+  auto watches = std::make_shared<inotify_watches>();
+  if(!watches->good()) return; // Not supported
+  int to_child[2], from_child[2];
+  ASSERT_EQ(0, pipe(to_child));
+  ASSERT_EQ(0, pipe(from_child));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: open the file, and close it when asked
+    char c = 'a';
+    close(to_child[1]);
+    close(from_child[0]);
+    const int fd = open(tmp_file.path.c_str(), O_RDONLY);
+    if(write(from_child[1], &c, 1) != 1 || read(to_child[0], &c, 1) != 1) _exit(1);
+    close(fd);
+    if(write(from_child[1], &c, 1) != 1) _exit(1);
+    while(read(to_child[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(to_child[0]);
+  close(from_child[1]);
+  char c = 'a';
+  ASSERT_EQ(1, read(from_child[0], &c, 1));
+
+  // Sampled through a duplicate, then skipped while idle
+  getfd_file_info updater(pid, false, false, 0, 1000, watches);
+  file_list       list;
+  for(int i = 0; i < 3; ++i)
+    ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+  const size_t duplicates = updater.duplicates();
+  if(duplicates > 0) {
+    EXPECT_LE((size_t)1, updater.stats().skipped);
+
+    // Closed by the process: the duplicate is dropped at the next update,
+    // not kept while the file is skipped
+    ASSERT_EQ(1, write(to_child[1], &c, 1));
+    ASSERT_EQ(1, read(from_child[0], &c, 1));
+    ASSERT_TRUE(updater.update_file_info(list, mono_now()));
+    EXPECT_EQ(duplicates - 1, updater.duplicates());
+    EXPECT_EQ((size_t)1, updater.stats().closed);
+  }
+
+  close(to_child[1]);
+  close(from_child[0]);
+  waitpid(pid, nullptr, 0);
+}
+
+TEST(PROC, find_children) {
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: wait for the parent to close the pipe
+    char c;
+    close(pipefd[1]);
+    while(read(pipefd[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(pipefd[0]);
+
+  std::vector<pid_t> children;
+  find_children(getpid(), children);
+  EXPECT_NE(children.end(), std::find(children.begin(), children.end(), pid));
+
+  close(pipefd[1]);
+  waitpid(pid, nullptr, 0);
+}
+
+TEST(PROC, cmd_matcher) {
+  const std::vector<const char*> patterns = { "gzip", "sam*" };
+  cmd_matcher exact(patterns);
+  EXPECT_TRUE(exact.match("gzip"));
+  EXPECT_FALSE(exact.match("gzip2"));
+  EXPECT_FALSE(exact.match("samtools"));
+
+  cmd_matcher glob(patterns, cmd_matcher::GLOB);
+  EXPECT_TRUE(glob.match("samtools"));
+  EXPECT_FALSE(glob.match("bgzip"));
+
+  const std::vector<const char*> regexes = { "^(b?gzip|pigz)$", "tools" };
+  cmd_matcher regex(regexes, cmd_matcher::REGEX);
+  EXPECT_TRUE(regex.error().empty());
+  EXPECT_TRUE(regex.match("bgzip"));
+  EXPECT_TRUE(regex.match("samtools"));
+  EXPECT_FALSE(regex.match("gzip2"));
+
+  const std::vector<const char*> invalid = { "(" };
+  cmd_matcher bad(invalid, cmd_matcher::REGEX);
+  EXPECT_FALSE(bad.error().empty());
+}
+
+TEST(PROC, find_cmds) {
+  std::ifstream comm("/proc/self/comm");
+  std::string name;
+  ASSERT_TRUE(std::getline(comm, name).good());
+
+  for(unsigned threads = 1; threads <= 4; threads *= 2) {
+    std::vector<pid_t> pids;
+    cmd_matcher matcher({ name.c_str() });
+    find_cmds(matcher, pids, threads);
+    EXPECT_NE(pids.end(), std::find(pids.begin(), pids.end(), getpid()));
+  }
+
+  std::vector<pid_t> pids;
+  cmd_matcher full({ "--gtest" }, cmd_matcher::GLOB, true);
+  find_cmds(full, pids);
+  EXPECT_EQ(pids.end(), std::find(pids.begin(), pids.end(), getpid()));
+}
+
+TEST(PROC, cmd_watcher) {
+  cmd_matcher matcher({ "sleep" });
+  cmd_watcher watcher(matcher);
+  std::vector<pid_t> pids;
+  watcher.poll(pids); // Nothing new
+  EXPECT_TRUE(pids.empty());
+
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) {
+    execlp("sleep", "sleep", "10", (char*)nullptr);
+    _exit(1);
+  }
+  usleep(100000); // Let the child exec
+  EXPECT_TRUE(watcher.check(pid));
+  watcher.poll(pids);
+  EXPECT_NE(pids.end(), std::find(pids.begin(), pids.end(), pid));
+
+  // Already seen
+  pids.clear();
+  watcher.poll(pids);
+  EXPECT_EQ(pids.end(), std::find(pids.begin(), pids.end(), pid));
+
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+
+  // Seen before its exec: found once it execs, without new process
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) {
+    char c;
+    close(pipefd[1]);
+    while(read(pipefd[0], &c, 1) > 0) ;
+    execlp("sleep", "sleep", "10", (char*)nullptr);
+    _exit(1);
+  }
+  close(pipefd[0]);
+  pids.clear();
+  watcher.poll(pids);
+  EXPECT_EQ(pids.end(), std::find(pids.begin(), pids.end(), pid));
+  close(pipefd[1]);
+  usleep(100000); // Let the child exec
+  watcher.poll(pids);
+  EXPECT_NE(pids.end(), std::find(pids.begin(), pids.end(), pid));
+
+  kill(pid, SIGTERM);
+  waitpid(pid, nullptr, 0);
+}
 } // namespace
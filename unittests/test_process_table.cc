@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <src/process_table.hpp>
+
+namespace {
+struct updater_mock : public file_info_updater {
+  updater_mock(pid_t pid) : file_info_updater(pid) { }
+  bool update_file_info(file_list& list, const mono_time& stamp) { return true; }
+  bool update_io_info(io_info& info, const mono_time& stamp) { return true; }
+};
+
+TEST(ProcessTable, insert_remove) {
+  process_table table;
+  EXPECT_TRUE(table.empty());
+
+  auto h1 = table.insert(updater_ptr(new updater_mock(10)));
+  auto h2 = table.insert(updater_ptr(new updater_mock(20)));
+  EXPECT_EQ((size_t)2, table.size());
+  ASSERT_NE(nullptr, table.get(h1));
+  EXPECT_EQ(10, table.get(h1)->updater->pid());
+  ASSERT_NE(nullptr, table.find(20));
+  EXPECT_EQ(table.get(h2), table.find(20));
+
+  table.remove(h1);
+  EXPECT_EQ((size_t)1, table.size());
+  EXPECT_EQ(nullptr, table.get(h1));
+  EXPECT_EQ(nullptr, table.find(10));
+  table.remove(h1); // Stale handle: no effect
+  EXPECT_EQ((size_t)1, table.size());
+
+  // The slot is reused, but the old handle stays stale
+  auto h3 = table.insert(updater_ptr(new updater_mock(30)));
+  EXPECT_EQ(h1.index, h3.index);
+  EXPECT_NE(h1, h3);
+  EXPECT_EQ(nullptr, table.get(h1));
+  ASSERT_NE(nullptr, table.get(h3));
+  EXPECT_EQ(30, table.get(h3)->updater->pid());
+  EXPECT_TRUE(table.get(h3)->files.list.empty());
+}
+
+TEST(ProcessTable, iterate) {
+  process_table table;
+  std::vector<process_table::handle> handles;
+  for(pid_t pid = 1; pid <= 5; ++pid)
+    handles.push_back(table.insert(updater_ptr(new updater_mock(pid))));
+  table.remove(handles[0]);
+  table.remove(handles[2]);
+  table.remove(handles[4]);
+
+  std::vector<pid_t> pids;
+  for(auto it = table.begin(); it != table.end(); ++it) {
+    EXPECT_EQ(table.get(it.get_handle()), &*it);
+    pids.push_back(it->updater->pid());
+  }
+  EXPECT_EQ((std::vector<pid_t>{ 2, 4 }), pids);
+}
+} // namespace
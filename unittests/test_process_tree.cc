@@ -0,0 +1,69 @@
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <src/process_tree.hpp>
+
+namespace {
+TEST(ProcessTree, add_remove) {
+  process_tree tree;
+  EXPECT_TRUE(tree.add_root(10));
+  EXPECT_FALSE(tree.add_root(10));
+  EXPECT_TRUE(tree.add_child(10, 11));
+  EXPECT_TRUE(tree.add_child(11, 12));
+  EXPECT_TRUE(tree.add_child(10, 13));
+  EXPECT_FALSE(tree.add_child(20, 21)); // Parent not followed
+  EXPECT_FALSE(tree.add_child(10, 12)); // Already in tree
+  EXPECT_EQ((size_t)4, tree.size());
+
+  process_tree::order_type order;
+  tree.order(order);
+  const process_tree::order_type expected = { { 10, 0 }, { 11, 1 }, { 12, 2 }, { 13, 1 } };
+  EXPECT_EQ(expected, order);
+
+  // The child of 11 moves up to 10
+  tree.remove(11);
+  EXPECT_FALSE(tree.contains(11));
+  tree.order(order);
+  const process_tree::order_type expected2 = { { 10, 0 }, { 13, 1 }, { 12, 1 } };
+  EXPECT_EQ(expected2, order);
+
+  // The children of a root become roots
+  tree.remove(10);
+  tree.order(order);
+  const process_tree::order_type expected3 = { { 13, 0 }, { 12, 0 } };
+  EXPECT_EQ(expected3, order);
+}
+
+TEST(ProcessTree, scan) {
+  int pipefd[2];
+  ASSERT_EQ(0, pipe(pipefd));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: wait for the parent to close the pipe
+    char c;
+    close(pipefd[1]);
+    while(read(pipefd[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(pipefd[0]);
+
+  process_tree tree;
+  tree.add_root(getpid());
+  std::vector<pid_t> new_pids;
+  tree.scan(new_pids);
+  EXPECT_NE(new_pids.end(), std::find(new_pids.begin(), new_pids.end(), pid));
+  EXPECT_TRUE(tree.contains(pid));
+
+  // Reaped: removed from the tree by the next scan
+  close(pipefd[1]);
+  waitpid(pid, nullptr, 0);
+  if(fork() == 0) _exit(0); // Create a process to force a scan
+  wait(nullptr);
+  new_pids.clear();
+  tree.scan(new_pids);
+  EXPECT_FALSE(tree.contains(pid));
+  EXPECT_TRUE(tree.contains(getpid()));
+}
+} // namespace
@@ -0,0 +1,109 @@
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <linux/kcmp.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <src/proc.hpp>
+#include <src/shared_files.hpp>
+
+namespace {
+struct unlink_file {
+  std::string path;
+  unlink_file(const char* p) : path(p) { }
+  ~unlink_file() { unlink(path.c_str()); };
+};
+
+// File of a process ending with path
+const file_info* find_name(const process_entry& entry, const std::string& path) {
+  for(const auto& file : entry.files) {
+    const std::string& name = file.name;
+    if(file.updated && name.size() > path.size() && !name.compare(name.size() - path.size(), std::string::npos, path))
+      return &file;
+  }
+  return nullptr;
+}
+
+TEST(SharedFiles, fork) {
+  const unlink_file inherited("test_shared_inherited");
+  const unlink_file separate("test_shared_separate");
+  { std::ofstream out(inherited.path.c_str()); out << "Hello the world"; }
+  { std::ofstream out(separate.path.c_str()); out << "Hello the world"; }
+  const int fd = open(inherited.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, fd);
+  if(syscall(SYS_kcmp, getpid(), getpid(), KCMP_FILE, fd, fd) != 0) { // Not supported
+    close(fd);
+    return;
+  }
+
+  int to_child[2], from_child[2];
+  ASSERT_EQ(0, pipe(to_child));
+  ASSERT_EQ(0, pipe(from_child));
+  pid_t pid = fork();
+  ASSERT_NE(-1, pid);
+  if(pid == 0) { // Child: open its own description of the separate file
+    char c = 'a';
+    close(to_child[1]);
+    close(from_child[0]);
+    open(separate.path.c_str(), O_RDONLY);
+    if(write(from_child[1], &c, 1) != 1) _exit(1);
+    while(read(to_child[0], &c, 1) > 0) ;
+    _exit(0);
+  }
+  close(to_child[0]);
+  close(from_child[1]);
+  char c;
+  ASSERT_EQ(1, read(from_child[0], &c, 1));
+  const int separate_fd = open(separate.path.c_str(), O_RDONLY);
+  ASSERT_LE(0, separate_fd);
+  lseek(fd, 7, SEEK_SET);
+
+  process_table processes;
+  const auto    parent_h = processes.insert(updater_ptr(new proc_file_info(getpid())));
+  const auto    child_h  = processes.insert(updater_ptr(new proc_file_info(pid)));
+  shared_files  shared;
+  for(auto& process : processes)
+    ASSERT_TRUE(process.updater->update_file_info(process.files, mono_now()));
+  shared.update(processes);
+
+  // The inherited description is displayed by the parent only
+  const process_entry& parent = *processes.get(parent_h);
+  const process_entry& child  = *processes.get(child_h);
+  const file_info*     owner  = find_name(parent, inherited.path);
+  const file_info*     copy   = find_name(child, inherited.path);
+  ASSERT_NE(nullptr, owner);
+  ASSERT_NE(nullptr, copy);
+  EXPECT_EQ(0, owner->owner);
+  ASSERT_NE(nullptr, owner->sharers);
+  EXPECT_EQ(std::vector<pid_t>({ pid }), *owner->sharers);
+  EXPECT_EQ(getpid(), copy->owner);
+  EXPECT_EQ((off_t)7, copy->offset);
+  EXPECT_LE((size_t)1, shared.size());
+
+  // Same inode, different descriptions
+  const file_info* parent_separate = find_name(parent, separate.path);
+  const file_info* child_separate  = find_name(child, separate.path);
+  ASSERT_NE(nullptr, parent_separate);
+  ASSERT_NE(nullptr, child_separate);
+  EXPECT_EQ(0, parent_separate->owner);
+  EXPECT_EQ(nullptr, parent_separate->sharers);
+  EXPECT_EQ(0, child_separate->owner);
+  EXPECT_EQ(nullptr, child_separate->sharers);
+
+  // Closed by the parent: the child displays its file
+  close(fd);
+  for(auto& process : processes)
+    ASSERT_TRUE(process.updater->update_file_info(process.files, mono_now()));
+  shared.update(processes);
+  copy = find_name(child, inherited.path);
+  ASSERT_NE(nullptr, copy);
+  EXPECT_EQ(0, copy->owner);
+  EXPECT_EQ(nullptr, find_name(parent, inherited.path));
+
+  close(separate_fd);
+  close(to_child[1]);
+  close(from_child[0]);
+  waitpid(pid, nullptr, 0);
+}
+} // namespace
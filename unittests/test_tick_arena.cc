@@ -0,0 +1,45 @@
+#include <dirent.h>
+#include <config.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <src/tick_arena.hpp>
+
+namespace {
+TEST(TickArena, grow) {
+  tick_arena arena(1024);
+  EXPECT_EQ((size_t)1024, arena.size());
+  {
+    std::pmr::vector<char> small(512, 'a', arena.resource());
+    std::pmr::vector<char> large(4096, 'b', arena.resource());
+  }
+  arena.reset();
+  EXPECT_LE((size_t)1024 + 4096, arena.size()); // Grown for the next update
+
+  // Fits in the buffer now: no allocation
+  const size_t   size  = arena.size();
+  const uint64_t count = allocation_count();
+  {
+    std::pmr::vector<char> small(512, 'a', arena.resource());
+    std::pmr::vector<char> large(4096, 'b', arena.resource());
+  }
+  arena.reset();
+  EXPECT_EQ(size, arena.size());
+  EXPECT_EQ(count, allocation_count());
+}
+
+TEST(TickArena, count) {
+  const uint64_t count = allocation_count();
+  std::vector<int>* v = new std::vector<int>(10);
+  EXPECT_LE(count + 2, allocation_count());
+  delete v;
+
+#if defined(COUNT_MALLOC) && defined(__GLIBC__)
+  // The allocations of the C library
+  const uint64_t before = allocation_count();
+  DIR* dir = opendir("/");
+  ASSERT_NE(nullptr, dir);
+  EXPECT_LT(before, allocation_count());
+  closedir(dir);
+#endif
+}
+}